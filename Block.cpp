@@ -1,8 +1,9 @@
+#include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <openssl/sha.h>
-#include <sstream>
 
 #include "Block.h"
+#include "Serialize.h"
 
 // ----------------------------------------------------------------------------
 // JSON serialization for BLOCK //
@@ -14,6 +15,7 @@ void to_json( json& j, const Block& b )
 
    j[ "index" ]        = b.index;
    j[ "prevHash" ]     = b.prevHash;
+   j[ "merkleRoot" ]   = b.merkleRoot;
    j[ "hash" ]         = b.hash;
    j[ "transactions" ] = b.txs;
    j[ "nonce" ]        = b.nonce;
@@ -26,6 +28,7 @@ void from_json( const json& j, Block& b )
 {
    j.at( "index" ).get_to( b.index );
    j.at( "prevHash" ).get_to( b.prevHash );
+   j.at( "merkleRoot" ).get_to( b.merkleRoot );
    j.at( "hash" ).get_to( b.hash );
    j.at( "transactions" ).get_to( b.txs );
    j.at( "nonce" ).get_to( b.nonce );
@@ -41,8 +44,9 @@ void from_json( const json& j, Block& b )
 json Block::toJson() const
 {
    json j;
-   j[ "index" ]    = index;
-   j[ "prevHash" ] = prevHash;
+   j[ "index" ]      = index;
+   j[ "prevHash" ]   = prevHash;
+   j[ "merkleRoot" ] = merkleRoot;
    // j[ "hash" ]         = hash;
    j[ "transactions" ] = txs;
    j[ "nonce" ]        = nonce;
@@ -61,48 +65,200 @@ std::string Block::toString() const
    return toJson().dump();
 }
 
+// ----------------------------------------------------------------------------
+Block::Header Block::header() const
+{
+   // The genesis block has no real predecessor, its prevHash is no digest and
+   // ends up as zeros in the header
+   crypto::Digest prev{};
+   crypto::fromHex( prevHash, prev );
+
+   crypto::Digest root{};
+   crypto::fromHex( merkleRoot, root );
+
+   auto timestampSeconds = std::chrono::duration_cast<std::chrono::seconds>(
+                               timestamp.time_since_epoch() )
+                               .count();
+
+   serialize::ByteWriter writer;
+   writer.putI32( index );
+   writer.putBytes( prev.data(), prev.size() );
+   writer.putBytes( root.data(), root.size() );
+   writer.putI64( timestampSeconds );
+   writer.putI32( difficulty );
+   writer.putU64( nonce );
+
+   Header result;
+   std::memcpy( result.data(), writer.data().data(), result.size() );
+   return result;
+}
+
+// ----------------------------------------------------------------------------
+crypto::Digest Block::calculateDigest() const
+{
+   auto bytes = header();
+   return crypto::sha256( bytes.data(), bytes.size() );
+}
+
 // ----------------------------------------------------------------------------
 std::string Block::calculateHash() const
 {
-   std::stringstream ss;
-   ss << index << prevHash;
-   auto timestamp_seconds = std::chrono::duration_cast<std::chrono::seconds>(
-                                timestamp.time_since_epoch() )
-                                .count();
-   ss << timestamp_seconds;
+   return crypto::toHex( calculateDigest() );
+}
+
+// ----------------------------------------------------------------------------
+std::string Block::calculateMerkleRoot() const
+{
+   if ( txs.empty() )
+   {
+      return crypto::toHex( crypto::Digest{} );
+   }
+
+   std::vector<crypto::Digest> level;
+   level.reserve( txs.size() );
+   for ( const auto& tx : txs )
+   {
+      level.push_back( tx.calculateHash() );
+   }
+
+   // Like bitcoin an odd node at the end of a level is paired with itself
+   while ( level.size() > 1 )
+   {
+      std::vector<crypto::Digest> next;
+      next.reserve( ( level.size() + 1 ) / 2 );
+      for ( size_t i = 0; i < level.size(); i += 2 )
+      {
+         const auto& left  = level[ i ];
+         const auto& right = i + 1 < level.size() ? level[ i + 1 ] : left;
+
+         crypto::Sha256 sha;
+         sha.update( left.data(), left.size() );
+         sha.update( right.data(), right.size() );
+         next.push_back( sha.finalize() );
+      }
+
+      level = std::move( next );
+   }
+
+   return crypto::toHex( level.front() );
+}
+
+// ----------------------------------------------------------------------------
+void Block::encode( serialize::ByteWriter& writer ) const
+{
+   auto timestampSeconds = std::chrono::duration_cast<std::chrono::seconds>(
+                               timestamp.time_since_epoch() )
+                               .count();
+
+   writer.putI32( index );
+   writer.putString( prevHash );
+   writer.putString( merkleRoot );
+   writer.putString( hash );
+   writer.putU64( nonce );
+   writer.putI32( difficulty );
+   writer.putI64( timestampSeconds );
+
+   writer.putU32( static_cast<uint32_t>( txs.size() ) );
+   for ( const auto& tx : txs )
+   {
+      tx.encode( writer );
+   }
+}
+
+// ----------------------------------------------------------------------------
+Block Block::decode( serialize::ByteReader& reader )
+{
+   Block b;
+   b.index      = reader.getI32();
+   b.prevHash   = reader.getString();
+   b.merkleRoot = reader.getString();
+   b.hash       = reader.getString();
+   b.nonce      = reader.getU64();
+   b.difficulty = reader.getI32();
+   b.timestamp  = std::chrono::system_clock::time_point(
+       std::chrono::seconds( reader.getI64() ) );
+
+   uint32_t txCount = reader.getU32();
+   b.txs.reserve( std::min<size_t>( txCount, reader.remaining() / 64 ) );
+   for ( uint32_t i = 0; i < txCount; ++i )
+   {
+      b.txs.push_back( Transaction::decode( reader ) );
+   }
+
+   return b;
+}
+
+// ----------------------------------------------------------------------------
+void Block::encodeCompact( serialize::ByteWriter& writer ) const
+{
+   auto timestampSeconds = std::chrono::duration_cast<std::chrono::seconds>(
+                               timestamp.time_since_epoch() )
+                               .count();
+
+   writer.putVarint( static_cast<uint32_t>( index ) );
+   writer.putHashString( prevHash );
+   writer.putHashString( merkleRoot );
+   writer.putHashString( hash );
+   writer.putVarint( nonce );
+   writer.putSignedVarint( difficulty );
+   writer.putSignedVarint( timestampSeconds );
+
+   writer.putVarint( txs.size() );
    for ( const auto& tx : txs )
    {
-      json j = tx;
-      ss << j.dump();
+      tx.encodeCompact( writer );
    }
-   ss << nonce;
+}
 
-   unsigned char hash[ SHA256_DIGEST_LENGTH ];
-   SHA256( reinterpret_cast<const unsigned char*>( ss.str().c_str() ),
-           ss.str().length(), hash );
+// ----------------------------------------------------------------------------
+Block Block::decodeCompact( serialize::ByteReader& reader )
+{
+   Block b;
+   b.index      = static_cast<int32_t>( reader.getVarint() );
+   b.prevHash   = reader.getHashString();
+   b.merkleRoot = reader.getHashString();
+   b.hash       = reader.getHashString();
+   b.nonce      = reader.getVarint();
+   b.difficulty = static_cast<int32_t>( reader.getSignedVarint() );
+   b.timestamp  = std::chrono::system_clock::time_point(
+       std::chrono::seconds( reader.getSignedVarint() ) );
 
-   std::stringstream hashHex;
-   for ( int i = 0; i < SHA256_DIGEST_LENGTH; i++ )
+   // A transaction takes at least 16 bytes
+   uint64_t txCount = reader.getVarint();
+   b.txs.reserve( std::min<size_t>( txCount, reader.remaining() / 16 ) );
+   for ( uint64_t i = 0; i < txCount; ++i )
    {
-      hashHex << std::hex << std::setw( 2 ) << std::setfill( '0' )
-              << static_cast<int>( hash[ i ] );
+      b.txs.push_back( Transaction::decodeCompact( reader ) );
    }
 
-   return hashHex.str();
+   return b;
+}
 
-   // auto data = toString();
+// ----------------------------------------------------------------------------
+static_assert( Block::HEADER_SIZE == crypto::MINING_HEADER_SIZE &&
+                   Block::NONCE_OFFSET == crypto::MINING_NONCE_OFFSET,
+               "Mining kernels depend on the header layout" );
 
-   // unsigned char hash_[ SHA256_DIGEST_LENGTH ];
-   // SHA256( ( unsigned char* ) data.c_str(), data.size(), hash_ );
+// ----------------------------------------------------------------------------
+BlockHasher::BlockHasher( const Block& block )
+{
+   auto bytes = block.header();
+   miningJob  = crypto::makeMiningJob( bytes.data() );
+}
 
-   // std::stringstream ss;
-   // for ( int i = 0; i < SHA256_DIGEST_LENGTH; i++ )
-   //{
-   //    ss << std::hex << std::setw( 2 ) << std::setfill( '0' )
-   //       << ( int ) hash_[ i ];
-   // }
+// ----------------------------------------------------------------------------
+crypto::Digest BlockHasher::hash( uint64_t nonce ) const
+{
+   crypto::Digest digest;
+   crypto::scalarMiningKernel().hash( miningJob, &nonce, &digest );
 
-   // return ss.str();
+   return digest;
+}
+
+// ----------------------------------------------------------------------------
+const crypto::MiningJob& BlockHasher::job() const
+{
+   return miningJob;
 }
 
 // ----------------------------------------------------------------------------
@@ -111,6 +267,7 @@ Block Block::fromJson( const json& j )
    Block b;
    j.at( "index" ).get_to( b.index );
    j.at( "prevhash" ).get_to( b.prevHash );
+   j.at( "merkleRoot" ).get_to( b.merkleRoot );
    j.at( "hash" ).get_to( b.hash );
    j.at( "nonce" ).get_to( b.nonce );
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <chrono>
 #include <string>
 #include <vector>
@@ -8,6 +9,9 @@
 #include "json/json.hpp"
 
 // Project
+#include "Hash.h"
+#include "MiningKernel.h"
+#include "Serialize.h"
 #include "Transaction.h"
 #include "UTXO.h"
 
@@ -27,16 +31,54 @@ class Block
    static Block fromJson( const json& j );
 
    // ----------------------------------------------------------------------------
-   std::string calculateHash() const;
+   // Only the fixed size header is hashed, the transactions are committed to
+   // via the merkle root. Integers are big endian, the nonce comes last:
+   // index(4) prevHash(32) merkleRoot(32) timestamp(8) difficulty(4) nonce(8)
+   static constexpr size_t HEADER_SIZE  = 88;
+   static constexpr size_t NONCE_OFFSET = 80;
+   using Header                         = std::array<unsigned char, HEADER_SIZE>;
 
-   int32_t                               index;
+   Header         header() const;
+   crypto::Digest calculateDigest() const;
+   std::string    calculateHash() const;   // Hex of calculateDigest
+
+   // Root over the hashes of all transactions, has to be set before mining
+   std::string calculateMerkleRoot() const;
+
+   // Lossless binary form used by the block store, throws std::out_of_range
+   // on short input
+   void         encode( serialize::ByteWriter& writer ) const;
+   static Block decode( serialize::ByteReader& reader );
+
+   // Compact and just as lossless form sent between nodes, see
+   // serialize::COMPACT_CONTENT_TYPE
+   void         encodeCompact( serialize::ByteWriter& writer ) const;
+   static Block decodeCompact( serialize::ByteReader& reader );
+
+   int32_t                               index{};
    std::string                           prevHash;
+   std::string                           merkleRoot;
    std::string                           hash;
    std::vector<Transaction>              txs;
-   uint64_t                              nonce;
-   int32_t                               difficulty;
+   uint64_t                              nonce{};
+   int32_t                               difficulty{};
    std::chrono::system_clock::time_point timestamp;
 };
 
+// ----------------------------------------------------------------------------
+// Mining helper, the first 64 header bytes are compressed once into the
+// midstate, every attempt only compresses the block holding the nonce.
+class BlockHasher
+{
+ public:
+   explicit BlockHasher( const Block& block );
+
+   crypto::Digest           hash( uint64_t nonce ) const;
+   const crypto::MiningJob& job() const;
+
+ private:
+   crypto::MiningJob miningJob;
+};
+
 void to_json( json& j, const Block& b );
 void from_json( const json& j, Block& b );
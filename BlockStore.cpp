@@ -0,0 +1,685 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "BlockStore.h"
+#include "Hash.h"
+#include "Serialize.h"
+
+namespace
+{
+constexpr uint32_t RECORD_MAGIC       = 0x545a424b;   // "TZBK"
+constexpr size_t   RECORD_HEADER_SIZE = 12;
+constexpr uint32_t INDEX_MAGIC        = 0x545a4249;   // "TZBI"
+constexpr uint32_t INDEX_VERSION      = 2;
+constexpr size_t   INDEX_HEADER_SIZE  = 8;
+constexpr size_t   INDEX_ENTRY_SIZE   = 48;
+constexpr size_t   MIN_MAPPED_SIZE    = 1024 * 1024;
+constexpr uint64_t MAX_SEGMENT_SIZE   = 16 * 1024 * 1024;
+
+// ----------------------------------------------------------------------------
+uint32_t checksum( std::string_view payload )
+{
+   auto digest = crypto::sha256( payload.data(), payload.size() );
+   return ( uint32_t( digest[ 0 ] ) << 24 ) | ( uint32_t( digest[ 1 ] ) << 16 ) |
+          ( uint32_t( digest[ 2 ] ) << 8 ) | uint32_t( digest[ 3 ] );
+}
+
+// ----------------------------------------------------------------------------
+// Returns the size of the record at offset or 0 if there is no intact one
+size_t parseRecord( std::string_view data, uint64_t offset,
+                    std::string_view& payload )
+{
+   if ( offset + RECORD_HEADER_SIZE > data.size() )
+   {
+      return 0;
+   }
+
+   serialize::ByteReader reader( data.substr( offset, RECORD_HEADER_SIZE ) );
+   uint32_t              magic  = reader.getU32();
+   uint32_t              length = reader.getU32();
+   uint32_t              sum    = reader.getU32();
+   if ( magic != RECORD_MAGIC ||
+        length > data.size() - offset - RECORD_HEADER_SIZE )
+   {
+      return 0;
+   }
+
+   payload = data.substr( offset + RECORD_HEADER_SIZE, length );
+   if ( checksum( payload ) != sum )
+   {
+      return 0;
+   }
+
+   return RECORD_HEADER_SIZE + length;
+}
+
+// ----------------------------------------------------------------------------
+// Same as parseRecord but also decodes the block
+size_t decodeRecord( std::string_view data, uint64_t offset, Block& block )
+{
+   std::string_view payload;
+   size_t           size = parseRecord( data, offset, payload );
+   if ( size == 0 )
+   {
+      return 0;
+   }
+
+   try
+   {
+      serialize::ByteReader reader( payload );
+      block = Block::decode( reader );
+      return size;
+   }
+   catch ( const std::exception& e )
+   {
+      std::cerr << "Error decoding stored block: " << e.what() << std::endl;
+      return 0;
+   }
+}
+
+// ----------------------------------------------------------------------------
+bool readFile( const std::string& path, std::string& data )
+{
+   std::ifstream file( path, std::ios::binary );
+   if ( !file.is_open() )
+   {
+      return false;
+   }
+
+   data.assign( ( std::istreambuf_iterator<char>( file ) ),
+                std::istreambuf_iterator<char>() );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+bool writeAll( int fd, const std::string& data )
+{
+   size_t written = 0;
+   while ( written < data.size() )
+   {
+      ssize_t n = ::write( fd, data.data() + written, data.size() - written );
+      if ( n < 0 )
+      {
+         if ( errno == EINTR )
+         {
+            continue;
+         }
+
+         return false;
+      }
+
+      written += static_cast<size_t>( n );
+   }
+
+   return true;
+}
+}   // namespace
+
+
+// ----------------------------------------------------------------------------
+BlockStore::BlockStore( std::string directory_, Sync sync_ )
+    : directory{ std::move( directory_ ) }, sync{ sync_ }
+{
+}
+
+// ----------------------------------------------------------------------------
+BlockStore::~BlockStore()
+{
+   close();
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::open()
+{
+   std::unique_lock lock( mutex );
+   return load();
+}
+
+// ----------------------------------------------------------------------------
+void BlockStore::close()
+{
+   std::unique_lock lock( mutex );
+   release();
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::append( const Block& block )
+{
+   std::unique_lock lock( mutex );
+   return write( block ) && flush();
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::reset( const std::vector<Block>& blocks )
+{
+   std::unique_lock lock( mutex );
+   release();
+
+   std::error_code ec;
+   std::filesystem::remove( indexPath(), ec );
+   uint32_t s = 0;
+   while ( std::filesystem::remove( segmentPath( s ), ec ) )
+   {
+      ++s;
+   }
+
+   if ( !load() )
+   {
+      return false;
+   }
+
+   // A single flush at the end, syncing every block of a whole chain would
+   // take ages
+   for ( const auto& block : blocks )
+   {
+      if ( !write( block ) )
+      {
+         return false;
+      }
+   }
+
+   return flush();
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::read( size_t height, Block& block ) const
+{
+   Location found;
+   {
+      std::shared_lock lock( mutex );
+      if ( height >= count )
+      {
+         return false;
+      }
+
+      found = location( height );
+   }
+
+   return readRecord( found, block );
+}
+
+// ----------------------------------------------------------------------------
+std::vector<Block> BlockStore::readAll() const
+{
+   std::shared_lock lock( mutex );
+
+   std::vector<Block> blocks;
+   blocks.reserve( count );
+
+   // Every segment is read in one go instead of a read per block
+   std::string data;
+   uint32_t    loaded = UINT32_MAX;
+   for ( size_t height = 0; height < count; ++height )
+   {
+      Location current = location( height );
+      if ( current.segment != loaded )
+      {
+         loaded = current.segment;
+         if ( !readFile( segmentPath( loaded ), data ) )
+         {
+            std::cerr << "Failed to open file: " << segmentPath( loaded )
+                      << std::endl;
+            return blocks;
+         }
+      }
+
+      Block block;
+      if ( decodeRecord( data, current.offset, block ) == 0 )
+      {
+         std::cerr << "Corrupt block record at height " << height << std::endl;
+         return blocks;
+      }
+
+      blocks.push_back( std::move( block ) );
+   }
+
+   return blocks;
+}
+
+// ----------------------------------------------------------------------------
+size_t BlockStore::size() const
+{
+   std::shared_lock lock( mutex );
+   return count;
+}
+
+// ----------------------------------------------------------------------------
+int64_t BlockStore::height( const std::string& hash ) const
+{
+   crypto::Digest digest;
+   if ( !crypto::fromHex( hash, digest ) )
+   {
+      return -1;
+   }
+
+   std::shared_lock lock( mutex );
+   auto             it = heights.find( digest );
+   return it != heights.end() ? static_cast<int64_t>( it->second ) : -1;
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::load()
+{
+   release();
+
+   std::error_code ec;
+   std::filesystem::create_directories( directory, ec );
+   if ( ec )
+   {
+      std::cerr << "Failed to create block directory: " << ec.message()
+                << std::endl;
+      return false;
+   }
+
+   // An entry only counts if it continues where the previous record ended and
+   // its record is on disk, after a crash the index can be ahead of a segment.
+   // An index without our header is ignored and rebuilt from the segments.
+   std::string indexData;
+   readFile( indexPath(), indexData );
+
+   serialize::ByteReader reader( indexData );
+   bool                  dirty = true;
+   if ( reader.remaining() >= INDEX_HEADER_SIZE &&
+        reader.getU32() == INDEX_MAGIC && reader.getU32() == INDEX_VERSION )
+   {
+      dirty = reader.remaining() % INDEX_ENTRY_SIZE != 0;
+   }
+   else
+   {
+      reader = serialize::ByteReader( std::string_view() );
+   }
+
+   std::vector<Location> locations;
+   uint32_t              sizedSegment = UINT32_MAX;
+   uint64_t              fileSize     = 0;
+   while ( reader.remaining() >= INDEX_ENTRY_SIZE )
+   {
+      Location current = decodeLocation( reader );
+
+      uint32_t expectedSegment =
+          locations.empty() ? 0 : locations.back().segment;
+      uint64_t expectedOffset =
+          locations.empty() ? 0
+                            : locations.back().offset + locations.back().size;
+      if ( !locations.empty() && current.segment == expectedSegment + 1 )
+      {
+         expectedSegment = current.segment;
+         expectedOffset  = 0;
+      }
+
+      if ( current.segment != sizedSegment )
+      {
+         sizedSegment = current.segment;
+         fileSize =
+             std::filesystem::file_size( segmentPath( sizedSegment ), ec );
+         fileSize = ec ? 0 : fileSize;
+      }
+
+      if ( current.segment != expectedSegment ||
+           current.offset != expectedOffset ||
+           current.offset + current.size > fileSize )
+      {
+         dirty = true;
+         break;
+      }
+
+      locations.push_back( current );
+   }
+
+   // Records that made it into a segment but not into the index, a crash right
+   // after starting a new segment may have left some in the next one too
+   const size_t indexed = locations.size();
+   uint32_t     last    = locations.empty() ? 0 : locations.back().segment;
+   uint64_t     end =
+       locations.empty() ? 0 : locations.back().offset + locations.back().size;
+   end = scanSegment( last, end, locations );
+   while ( std::filesystem::exists( segmentPath( last + 1 ) ) )
+   {
+      uint64_t nextEnd = scanSegment( last + 1, 0, locations );
+      if ( nextEnd == 0 )
+      {
+         break;
+      }
+
+      ++last;
+      end = nextEnd;
+   }
+
+   if ( locations.size() != indexed )
+   {
+      std::cout << "Recovered " << locations.size() - indexed
+                << " unindexed blocks\n";
+      dirty = true;
+   }
+
+   if ( dirty && !rewriteIndex( locations ) )
+   {
+      return false;
+   }
+
+   // Needs read access for the mapping
+   indexFd = ::open( indexPath().c_str(), O_RDWR | O_CREAT | O_APPEND, 0644 );
+   if ( indexFd < 0 )
+   {
+      std::cerr << "Failed to open file: " << indexPath() << std::endl;
+      return false;
+   }
+
+   count = locations.size();
+   heights.reserve( count );
+   for ( size_t height = 0; height < count; ++height )
+   {
+      heights.emplace( locations[ height ].hash,
+                       static_cast<uint32_t>( height ) );
+   }
+
+   // Cuts off a torn record at the end of the segment
+   return mapIndex( count ) && openSegment( last, end );
+}
+
+// ----------------------------------------------------------------------------
+void BlockStore::release()
+{
+   unmapIndex();
+   count = 0;
+   heights.clear();
+
+   if ( segmentFd >= 0 )
+   {
+      ::close( segmentFd );
+      segmentFd = -1;
+   }
+
+   if ( indexFd >= 0 )
+   {
+      ::close( indexFd );
+      indexFd = -1;
+   }
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::write( const Block& block )
+{
+   if ( segmentFd < 0 || indexFd < 0 )
+   {
+      std::cerr << "Block store is not open" << std::endl;
+      return false;
+   }
+
+   // Grown before anything is written, a failing remap leaves no trace
+   if ( !mapIndex( count + 1 ) )
+   {
+      return false;
+   }
+
+   serialize::ByteWriter payload;
+   block.encode( payload );
+
+   serialize::ByteWriter record;
+   record.putU32( RECORD_MAGIC );
+   record.putU32( static_cast<uint32_t>( payload.data().size() ) );
+   record.putU32( checksum( payload.data() ) );
+   record.putBytes( payload.data().data(), payload.data().size() );
+
+   if ( segmentSize > 0 &&
+        segmentSize + record.data().size() > MAX_SEGMENT_SIZE )
+   {
+      // The old segment has to be complete before the index points past it
+      if ( ( sync == Sync::EveryBlock && ::fsync( segmentFd ) != 0 ) ||
+           !openSegment( segment + 1, 0 ) )
+      {
+         return false;
+      }
+   }
+
+   Location current{ segment, segmentSize,
+                     static_cast<uint32_t>( record.data().size() ), {} };
+   crypto::fromHex( block.hash, current.hash );
+
+   serialize::ByteWriter entry;
+   encodeLocation( entry, current );
+
+   // A failed write is rolled back, otherwise later offsets would be off
+   if ( !writeAll( segmentFd, record.data() ) )
+   {
+      std::cerr << "Failed to write block: " << std::strerror( errno )
+                << std::endl;
+      ::ftruncate( segmentFd, static_cast<off_t>( segmentSize ) );
+      return false;
+   }
+
+   if ( !writeAll( indexFd, entry.data() ) )
+   {
+      std::cerr << "Failed to write block index: " << std::strerror( errno )
+                << std::endl;
+      ::ftruncate( indexFd, static_cast<off_t>( INDEX_HEADER_SIZE +
+                                                count * INDEX_ENTRY_SIZE ) );
+      ::ftruncate( segmentFd, static_cast<off_t>( segmentSize ) );
+      return false;
+   }
+
+   segmentSize += current.size;
+   heights.emplace( current.hash, static_cast<uint32_t>( count ) );
+   ++count;
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::flush()
+{
+   if ( sync == Sync::None )
+   {
+      return true;
+   }
+
+   if ( ::fsync( segmentFd ) != 0 || ::fsync( indexFd ) != 0 )
+   {
+      std::cerr << "Failed to sync block store: " << std::strerror( errno )
+                << std::endl;
+      return false;
+   }
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::openSegment( uint32_t segment_, uint64_t size )
+{
+   if ( segmentFd >= 0 )
+   {
+      ::close( segmentFd );
+   }
+
+   const std::string path = segmentPath( segment_ );
+   segmentFd = ::open( path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644 );
+   if ( segmentFd < 0 )
+   {
+      std::cerr << "Failed to open file: " << path << std::endl;
+      return false;
+   }
+
+   if ( ::ftruncate( segmentFd, static_cast<off_t>( size ) ) != 0 )
+   {
+      std::cerr << "Failed to truncate file: " << path << std::endl;
+      return false;
+   }
+
+   segment     = segment_;
+   segmentSize = size;
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::mapIndex( size_t entries )
+{
+   const size_t needed = INDEX_HEADER_SIZE + entries * INDEX_ENTRY_SIZE;
+   if ( indexMap != nullptr && needed <= mappedSize )
+   {
+      return true;
+   }
+
+   // The mapping reaches past the end of the file, appends through indexFd
+   // show up in it without remapping until it is full
+   unmapIndex();
+   size_t size = std::max( needed * 2, MIN_MAPPED_SIZE );
+   void*  map  = ::mmap( nullptr, size, PROT_READ, MAP_SHARED, indexFd, 0 );
+   if ( map == MAP_FAILED )
+   {
+      std::cerr << "Failed to map block index: " << std::strerror( errno )
+                << std::endl;
+      return false;
+   }
+
+   indexMap   = static_cast<const unsigned char*>( map );
+   mappedSize = size;
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+void BlockStore::unmapIndex()
+{
+   if ( indexMap != nullptr )
+   {
+      ::munmap( const_cast<unsigned char*>( indexMap ), mappedSize );
+      indexMap   = nullptr;
+      mappedSize = 0;
+   }
+}
+
+// ----------------------------------------------------------------------------
+BlockStore::Location BlockStore::location( size_t height ) const
+{
+   const char* entry = reinterpret_cast<const char*>( indexMap ) +
+                       INDEX_HEADER_SIZE + height * INDEX_ENTRY_SIZE;
+
+   serialize::ByteReader reader( std::string_view( entry, INDEX_ENTRY_SIZE ) );
+   return decodeLocation( reader );
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::readRecord( const Location& location, Block& block ) const
+{
+   const std::string path = segmentPath( location.segment );
+
+   int fd = ::open( path.c_str(), O_RDONLY );
+   if ( fd < 0 )
+   {
+      std::cerr << "Failed to open file: " << path << std::endl;
+      return false;
+   }
+
+   std::string data( location.size, '\0' );
+   ssize_t     n = ::pread( fd, data.data(), data.size(),
+                            static_cast<off_t>( location.offset ) );
+   ::close( fd );
+
+   return n == static_cast<ssize_t>( data.size() ) &&
+          decodeRecord( data, 0, block ) != 0;
+}
+
+// ----------------------------------------------------------------------------
+bool BlockStore::rewriteIndex( const std::vector<Location>& locations )
+{
+   serialize::ByteWriter writer;
+   writer.putU32( INDEX_MAGIC );
+   writer.putU32( INDEX_VERSION );
+   for ( const auto& current : locations )
+   {
+      encodeLocation( writer, current );
+   }
+
+   // Same as the UTXO snapshot, renaming keeps the old index on a crash
+   const std::string tmpName = indexPath() + ".tmp";
+   int fd = ::open( tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+   if ( fd < 0 )
+   {
+      std::cerr << "Failed to open file: " << tmpName << std::endl;
+      return false;
+   }
+
+   bool ok = writeAll( fd, writer.data() ) && ::fsync( fd ) == 0;
+   ::close( fd );
+
+   std::error_code ec;
+   if ( ok )
+   {
+      std::filesystem::rename( tmpName, indexPath(), ec );
+   }
+
+   if ( !ok || ec )
+   {
+      std::cerr << "Failed to rewrite block index" << std::endl;
+      return false;
+   }
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+uint64_t BlockStore::scanSegment( uint32_t segment_, uint64_t offset,
+                                  std::vector<Location>& locations ) const
+{
+   std::string data;
+   if ( !readFile( segmentPath( segment_ ), data ) )
+   {
+      return offset;
+   }
+
+   // The hash is only in the payload, so recovery has to decode the blocks
+   Block block;
+   while ( size_t size = decodeRecord( data, offset, block ) )
+   {
+      Location current{ segment_, offset, static_cast<uint32_t>( size ), {} };
+      crypto::fromHex( block.hash, current.hash );
+      locations.push_back( current );
+      offset += size;
+   }
+
+   return offset;
+}
+
+// ----------------------------------------------------------------------------
+void BlockStore::encodeLocation( serialize::ByteWriter& writer,
+                                 const Location&        location )
+{
+   writer.putU32( location.segment );
+   writer.putU64( location.offset );
+   writer.putU32( location.size );
+   writer.putBytes( location.hash.data(), location.hash.size() );
+}
+
+// ----------------------------------------------------------------------------
+BlockStore::Location BlockStore::decodeLocation( serialize::ByteReader& reader )
+{
+   Location location;
+   location.segment = reader.getU32();
+   location.offset  = reader.getU64();
+   location.size    = reader.getU32();
+   reader.getBytes( location.hash.data(), location.hash.size() );
+   return location;
+}
+
+// ----------------------------------------------------------------------------
+std::string BlockStore::segmentPath( uint32_t segment_ ) const
+{
+   char name[ 16 ];
+   std::snprintf( name, sizeof( name ), "blk%05u.dat", segment_ );
+   return ( std::filesystem::path( directory ) / name ).string();
+}
+
+// ----------------------------------------------------------------------------
+std::string BlockStore::indexPath() const
+{
+   return ( std::filesystem::path( directory ) / "index.dat" ).string();
+}
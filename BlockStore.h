@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Block.h"
+#include "Hash.h"
+
+// ----------------------------------------------------------------------------
+// Append-only block storage. Blocks are written as records into segment files
+// blocks/blk00000.dat, blk00001.dat, ... and a fixed size entry per block in
+// blocks/index.dat tells where the record of each height lives. Adding a block
+// costs one append to each file instead of rewriting the whole chain.
+//
+// Record: magic(4) length(4) checksum(4) payload(length), the checksum is the
+// start of the payload's sha256.
+// Index: magic(4) version(4), then per height segment(4) offset(8) size(4)
+// hash(32). All integers are big endian.
+//
+// The index is memory mapped, a block is read by height through its entry.
+// The height of a hash comes from a map built from the index entries while
+// loading. Lookups may run concurrently with an append.
+class BlockStore
+{
+ public:
+   enum class Sync
+   {
+      None,         // Leave flushing to the OS, a crash may lose recent blocks
+      EveryBlock,   // fsync segment and index after every append
+   };
+
+   explicit BlockStore( std::string directory, Sync sync = Sync::EveryBlock );
+   ~BlockStore();
+
+   BlockStore( const BlockStore& )            = delete;
+   BlockStore& operator=( const BlockStore& ) = delete;
+
+   // Loads the index and repairs what a crash may have left behind, records
+   // missing in the index are re-indexed and a torn tail is cut off. An index
+   // in an unknown format is rebuilt from the segments.
+   bool open();
+   void close();
+
+   bool append( const Block& block );
+   // Replaces everything stored, used when the chain got taken over from a peer
+   bool reset( const std::vector<Block>& blocks );
+
+   bool               read( size_t height, Block& block ) const;
+   std::vector<Block> readAll() const;
+   size_t             size() const;
+
+   // Returns -1 if no stored block has this hash
+   int64_t height( const std::string& hash ) const;
+
+ private:
+   struct Location
+   {
+      uint32_t       segment;
+      uint64_t       offset;
+      uint32_t       size;
+      crypto::Digest hash;
+   };
+
+   bool readRecord( const Location& location, Block& block ) const;
+
+   // Everything below expects the caller to hold mutex
+   bool     load();
+   void     release();
+   Location location( size_t height ) const;
+
+   bool write( const Block& block );
+   bool flush();
+   bool openSegment( uint32_t segment, uint64_t size );
+   // Makes sure the mapping covers the given number of entries
+   bool mapIndex( size_t entries );
+   void unmapIndex();
+   bool rewriteIndex( const std::vector<Location>& locations );
+   // Indexes the valid records of a segment from offset on, returns where the
+   // last valid record ends
+   uint64_t scanSegment( uint32_t segment, uint64_t offset,
+                         std::vector<Location>& locations ) const;
+
+   static void     encodeLocation( serialize::ByteWriter& writer,
+                                   const Location&        location );
+   static Location decodeLocation( serialize::ByteReader& reader );
+
+   std::string segmentPath( uint32_t segment ) const;
+   std::string indexPath() const;
+
+   std::string directory;
+   Sync        sync;
+
+   // Appends remap the index, lookups hold the lock shared
+   mutable std::shared_mutex mutex;
+
+   const unsigned char* indexMap   = nullptr;
+   size_t               mappedSize = 0;
+   size_t               count      = 0;   // Blocks in the index
+   // Hash of every indexed block, filled by load() and write()
+   std::unordered_map<crypto::Digest, uint32_t, crypto::DigestHash> heights;
+
+   int      segmentFd   = -1;
+   int      indexFd     = -1;
+   uint32_t segment     = 0;   // Segment currently appended to
+   uint64_t segmentSize = 0;
+};
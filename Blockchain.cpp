@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <ctime>
 #include <filesystem>
 #include <fstream>
@@ -6,10 +7,14 @@
 #include <memory>
 #include <openssl/sha.h>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "Blockchain.h"
 #include "Node.h"
+#include "Serialize.h"
 #include "UTXO.h"
 
 // ----------------------------------------------------------------------------
@@ -20,52 +25,75 @@ void Blockchain::setupChain()
 {
    std::cout << "Setting up chain\n";
 
-   // Make sure our callback is set
-   std::vector<Block> newChain;
+   // Stored chain first, the sync skips downloading blocks we already have.
+   // It was validated while loading.
+   std::vector<Block> newChain = loadStoredChain();
    if ( syncChainCallback )
    {
       std::vector<Block> chainFromPeer = syncChainCallback();
-      auto               chainFromFile = loadChain( "chain.json" );
 
-      if ( !chainFromPeer.empty() && ( chainFromPeer.size() - 1 > chainFromFile.size() - 1 ) )
+      // A peer chain failing validation leaves the stored one in place
+      if ( chainFromPeer.size() > newChain.size() )
       {
-         std::cout << "Chain from peer was chosen to be the new chain\n";
-         newChain = std::move( chainFromPeer );
-      }
-      else
-      {
-         newChain = std::move( chainFromFile );
-         if ( !newChain.empty() )
+         if ( chainFromPeer[ 0 ].prevHash == "Mojo" &&
+              isChainValid( chainFromPeer ) )
          {
-            std::cout << "Chain from file was choosen to be the new chain\n";
+            std::cout << "Chain from peer was chosen to be the new chain\n";
+            newChain = std::move( chainFromPeer );
+         }
+         else
+         {
+            std::cout << "Chain from peer is invalid\n";
          }
       }
-   }
-   else
-   {
-      auto newChain = loadChain( "chain.json" );
+      else if ( !newChain.empty() )
+      {
+         std::cout << "Chain from file was choosen to be the new chain\n";
+      }
    }
 
-   // Making sure the chain is valid
-   if ( newChain.size() > 1 && newChain[ 0 ].prevHash == "Mojo" &&
-        isChainValid( newChain ) )
+   if ( newChain.size() > 1 && newChain[ 0 ].prevHash == "Mojo" )
    {
-      chain = std::move( newChain );
-      recomputeUTXOSet();
-      saveChain( "chain.json" );
+      {
+         std::unique_lock<std::shared_mutex> lock( chainMutex );
+         chain = std::move( newChain );
+      }
+      restoreUTXOSet();
+
+      // A chain from a peer is always longer than the stored one and gets
+      // written to the store. A chain read from the store is already on disk.
+      if ( blockStore.size() != chain.size() )
+      {
+         blockStore.reset( chain );
+      }
+
+      saveUTXOSnapshot( UTXO_SNAPSHOT_FILE );
    }
    else
    {
       // I will assume the genesis block is always the same
       std::cout << "No longer chain found in peers and no chain loaded from "
                    "file, creating new chain\n";
-      chain.push_back( createGenesisBlock() );
+      {
+         std::unique_lock<std::shared_mutex> lock( chainMutex );
+         chain.push_back( createGenesisBlock() );
+      }
+      blockStore.reset( chain );
    }
 }
 
 // ----------------------------------------------------------------------------
 bool Blockchain::addTransaction( const Transaction& tx )
 {
+   std::lock_guard<std::mutex> lock( pendingTxsMutex );
+
+   // Before validation, a parent that expires must not be spent from. Also
+   // keeps MAX_AGE on nodes that never build a template.
+   if ( size_t expired = mempool.expire() )
+   {
+      std::cout << "Expired " << expired << " stale transactions\n";
+   }
+
    if ( !isValidTransaction( tx ) )
    {
       std::cerr << "Invalid transaction: " << tx.toJson().dump( 4 )
@@ -77,100 +105,159 @@ bool Blockchain::addTransaction( const Transaction& tx )
    std::cout << "Adding transaction to mempool: " << tx.toJson().dump( 4 )
              << std::endl;
 
-   pendingTxs.push_back( tx );
-   return true;
+   // The mempool may turn it down for its fee rate when it is full
+   return mempool.add( tx );
 }
 
 // ----------------------------------------------------------------------------
 bool Blockchain::isChainValid( const std::vector<Block>& chain ) const
 {
+   // Linkage is one string compare per block, checking it up front means a
+   // broken chain costs no hashing at all
    for ( size_t i = 1; i < chain.size(); i++ )
    {
-      const Block& current = chain[ i ];
-      const Block& prev    = chain[ i - 1 ];
-
-      if ( current.hash != current.calculateHash() )
+      if ( chain[ i ].prevHash != chain[ i - 1 ].hash )
       {
          return false;
       }
+   }
 
-      if ( current.prevHash != prev.hash )
+   // Everything else only depends on the block itself. The blocks are split
+   // into contiguous ranges, one per worker, on the same number of threads
+   // mining uses. Small chains are not worth starting threads for.
+   const size_t blocks  = chain.size() > 1 ? chain.size() - 1 : 0;
+   const size_t workers = std::min<size_t>(
+       miner.getThreads(), blocks / MIN_BLOCKS_PER_VALIDATOR );
+   if ( workers <= 1 )
+   {
+      for ( size_t i = 1; i < chain.size(); i++ )
       {
-         return false;
+         if ( !isBlockValid( chain[ i ] ) )
+         {
+            return false;
+         }
       }
 
-      if ( !isValidPoW( current.hash, current.difficulty ) )
-      {
-         return false;
-      }
+      return true;
    }
 
-   return true;
+   std::atomic<bool>        valid{ true };
+   std::vector<std::thread> threads;
+   threads.reserve( workers );
+   for ( size_t w = 0; w < workers; ++w )
+   {
+      const size_t first = 1 + blocks * w / workers;
+      const size_t last  = 1 + blocks * ( w + 1 ) / workers;
+      threads.emplace_back(
+          [ this, &chain, &valid, first, last ]()
+          {
+             // Once any worker found an invalid block the others stop too
+             for ( size_t i = first;
+                   i < last && valid.load( std::memory_order_relaxed ); ++i )
+             {
+                if ( !isBlockValid( chain[ i ] ) )
+                {
+                   valid = false;
+                }
+             }
+          } );
+   }
+
+   for ( auto& thread : threads )
+   {
+      thread.join();
+   }
+
+   return valid;
 }
+
 // ----------------------------------------------------------------------------
 bool Blockchain::isChainValid() const
 {
-   for ( size_t i = 1; i < chain.size(); i++ )
-   {
-      const Block& current = chain[ i ];
-      const Block& prev    = chain[ i - 1 ];
+   return isChainValid( chain );
+}
 
-      if ( current.hash != current.calculateHash() )
+// ----------------------------------------------------------------------------
+bool Blockchain::isBlockValid( const Block& block ) const
+{
+   // The merkle root only commits to whole units
+   for ( const auto& tx : block.txs )
+   {
+      if ( !tx.hasExactAmounts() )
       {
          return false;
       }
+   }
 
-      if ( current.prevHash != prev.hash )
-      {
-         return false;
-      }
+   if ( block.merkleRoot != block.calculateMerkleRoot() )
+   {
+      return false;
+   }
 
-      if ( !isValidPoW( current.hash, current.difficulty ) )
-      {
-         return false;
-      }
+   // Hex only matters for json, the checks work on the raw digest
+   const auto digest = block.calculateDigest();
+   if ( !crypto::hexEquals( block.hash, digest ) )
+   {
+      return false;
    }
 
-   return true;
+   return isValidPoW( digest, block.difficulty );
 }
 
 // ----------------------------------------------------------------------------
-bool Blockchain::isValidPoW( const std::string& hash, int difficulty ) const
+bool Blockchain::isValidPoW( const crypto::Digest& digest,
+                             int                   difficulty ) const
 {
-   return hash.substr( 0, difficulty ) == std::string( difficulty, '0' );
+   return crypto::meetsDifficulty( digest, difficulty );
 }
 
 // ----------------------------------------------------------------------------
-void Blockchain::mineBlock( Block& block, int difficulty )
+bool Blockchain::mineBlock( Block& block, int difficulty,
+                           uint64_t generation )
 {
    block.difficulty = difficulty;
    block.nonce      = 0;
-   while ( true )
-   {
-      block.hash = block.calculateHash();
-      if ( isValidPoW( block.hash, block.difficulty ) )
-      {
-         break;
-      }
 
-      block.nonce++;
-   }
+   return miner.mine( block, generation );
 }
 
 // ----------------------------------------------------------------------------
-void Blockchain::mineBlock()
+bool Blockchain::mineBlock()
 {
-   Block newBlock;
-   newBlock.index     = chain.size();
-   newBlock.prevHash  = chain.back().hash;
-   newBlock.txs       = std::move( pendingTxs );
-   newBlock.timestamp = getCurrentTime();
-   pendingTxs.clear();
+   const uint64_t generation = miner.generation();
 
-   mineBlock( newBlock, difficulty );
+   Block newBlock;
+   newBlock.index      = chain.size();
+   newBlock.prevHash   = chain.back().hash;
+   newBlock.txs        = mempool.select( mempool.size() );
+   newBlock.timestamp  = getCurrentTime();
+   newBlock.merkleRoot = newBlock.calculateMerkleRoot();
+   mempool.clear();
+
+   if ( !mineBlock( newBlock, difficulty, generation ) )
+   {
+      return false;
+   }
 
-   chain.push_back( newBlock );
+   {
+      std::unique_lock<std::shared_mutex> lock( chainMutex );
+      chain.push_back( newBlock );
+   }
    std::cout << "Block mined: " << newBlock.hash << std::endl;
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+void Blockchain::setMiningThreads( uint32_t threads )
+{
+   miner.setThreads( threads );
+}
+
+// ----------------------------------------------------------------------------
+void Blockchain::setMempoolLimit( size_t bytes )
+{
+   std::lock_guard<std::mutex> lock( pendingTxsMutex );
+   mempool.setMaxBytes( bytes );
 }
 
 // ----------------------------------------------------------------------------
@@ -200,35 +287,59 @@ int32_t Blockchain::adjustDifficulty() const
       return getEpochDifficulty();
    }
 
-   auto lastBlockTime    = chain.back().timestamp;
-   auto tenBlocksAgoTime = chain[ chain.size() - 10 ].timestamp;
-   auto duration         = lastBlockTime - tenBlocksAgoTime;
+   const auto seconds = []( const Block& block )
+   {
+      return std::chrono::duration_cast<std::chrono::seconds>(
+                 block.timestamp.time_since_epoch() )
+          .count();
+   };
+
+   const int32_t previous      = chain.back().difficulty;
+   const int32_t newDifficulty = retargetDifficulty(
+       previous,
+       seconds( chain.back() ) - seconds( chain[ chain.size() - 10 ] ) );
+
+   if ( newDifficulty > previous )
+   {
+      std::cout << "Difficulty increased to " << newDifficulty << std::endl;
+   }
+   else if ( newDifficulty < previous )
+   {
+      std::cout << "Difficulty decreased to " << newDifficulty << std::endl;
+   }
+
+   return newDifficulty;
+}
 
-   auto seconds =
-       std::chrono::duration_cast<std::chrono::seconds>( duration ).count();
+// ----------------------------------------------------------------------------
+bool Blockchain::isRetargetHeight( size_t height )
+{
+   return height % 10 == 0 && height >= 10;
+}
 
+// ----------------------------------------------------------------------------
+int32_t Blockchain::retargetDifficulty( int32_t previous, int64_t seconds )
+{
    const int targetSeconds = 100;   // 10 seconds per block × 10 blocks
-   int       newDifficulty = chain.back().difficulty;
 
    if ( seconds < targetSeconds )
    {
-      newDifficulty++;
-      std::cout << "Difficulty increased to " << difficulty << std::endl;
+      return previous + 1;
    }
-   else if ( seconds > targetSeconds && difficulty > 1 )
+
+   if ( seconds > targetSeconds && previous > 1 )
    {
-      newDifficulty--;
-      std::cout << "Difficulty decreased to " << difficulty << std::endl;
+      return previous - 1;
    }
 
-   return newDifficulty;
+   return previous;
 }
 
 // ----------------------------------------------------------------------------
 bool Blockchain::addBlock( const Block& block )
 {
    int32_t rewardCount{};
-   double  totalFees;
+   int64_t totalFees{};   // In units
 
    int32_t expectedDifficulty = calculateExpectedDifficulty();
    if ( block.difficulty != expectedDifficulty )
@@ -238,7 +349,58 @@ bool Blockchain::addBlock( const Block& block )
       return false;
    }
 
-   std::set<std::pair<std::string, int>> usedUTXOs;
+   // Header checks come first, a block failing them must not touch the UTXO
+   // set or the mempool
+   // Index starts at 0 means the new block.index should be equal to the current
+   // chain size
+   if ( block.index != chain.size() )
+   {
+      std::cerr << "Invalid block index" << std::endl;
+      return false;
+   }
+
+   if ( block.prevHash != chain.back().hash )
+   {
+      std::cerr << "Invalid previous hash" << std::endl;
+      return false;
+   }
+
+   const auto digest = block.calculateDigest();
+   if ( !isValidPoW( digest, block.difficulty ) )
+   {
+      std::cerr << "Invalid proof of work" << std::endl;
+      return false;
+   }
+
+   // The header only commits to the transactions via the merkle root, which
+   // holds amounts in whole units. Anything finer could be changed by a
+   // relayer without changing the hash.
+   for ( const auto& tx : block.txs )
+   {
+      if ( !tx.hasExactAmounts() )
+      {
+         std::cerr << "Amount finer than a unit in " << tx.txid << std::endl;
+         return false;
+      }
+   }
+
+   if ( block.merkleRoot != block.calculateMerkleRoot() )
+   {
+      std::cerr << "Invalid merkle root" << std::endl;
+      return false;
+   }
+
+   // checkHash
+   if ( !crypto::hexEquals( block.hash, digest ) )
+   {
+      std::cerr << "Invalid Hash" << std::endl;
+      return false;
+   }
+
+   std::unordered_set<utxo::Outpoint, utxo::OutpointHash> usedUTXOs;
+   // Outputs of earlier transactions in this block, a child may follow its
+   // parent
+   std::unordered_map<utxo::Outpoint, double, utxo::OutpointHash> created;
    for ( const auto& tx : block.txs )
    {
       if ( tx.isReward )
@@ -259,11 +421,11 @@ bool Blockchain::addBlock( const Block& block )
       }
       else
       {
-         // Validate regular transaction
-         double inputSum = 0;
+         // Validate regular transaction, sums in units are exact
+         int64_t inputSum = 0;
          for ( const auto& input : tx.inputs )
          {
-            auto utxoKey = std::make_pair( input.txid, input.outputIndex );
+            utxo::Outpoint utxoKey{ input.txid, input.outputIndex };
             if ( usedUTXOs.find( utxoKey ) != usedUTXOs.end() )
             {
                std::cerr
@@ -272,34 +434,41 @@ bool Blockchain::addBlock( const Block& block )
                return false;
             }
 
-            auto it =
-                std::find_if( utxoSet.begin(), utxoSet.end(),
-                              [ & ]( const utxo::UTXO& u ) {
-                                 return u.txid == input.txid &&
-                                        u.outputIndex == input.outputIndex;
-                              } );
-
-            if ( it == utxoSet.end() )
+            double amount = 0.0;
+            if ( const utxo::UTXO* spent =
+                     utxoSet.find( input.txid, input.outputIndex ) )
+            {
+               amount = spent->amount;
+            }
+            else if ( auto earlier = created.find( utxoKey );
+                      earlier != created.end() )
+            {
+               amount = earlier->second;
+            }
+            else
             {
                std::cerr << "UTXO not found\n";
                return false;   // UTXO not found
             }
 
-            usedUTXOs.insert( utxoKey );
+            usedUTXOs.insert( std::move( utxoKey ) );
 
-            inputSum += it->amount;
+            inputSum += serialize::toUnits( amount );
          }
 
-         double outputSum = 0;
-         for ( const auto& output : tx.outputs )
+         int64_t outputSum = 0;
+         for ( size_t i = 0; i < tx.outputs.size(); ++i )
          {
-            outputSum += output.amount;
+            outputSum += serialize::toUnits( tx.outputs[ i ].amount );
+            created.emplace( utxo::Outpoint{ tx.txid, static_cast<int>( i ) },
+                             tx.outputs[ i ].amount );
          }
 
          if ( inputSum < outputSum )
          {
-            std::cerr << "Insufficient funds, inputSum: " << inputSum
-                      << " outputSum: " << outputSum << std::endl;
+            std::cerr << "Insufficient funds, inputSum: "
+                      << serialize::fromUnits( inputSum ) << " outputSum: "
+                      << serialize::fromUnits( outputSum ) << std::endl;
             return false;   // Invalid amounts
          }
 
@@ -308,118 +477,69 @@ bool Blockchain::addBlock( const Block& block )
    }
 
    // Update UTXO set
-   for ( const auto& tx : block.txs )
-   {
-      // Remove consumed UTXOs
-      for ( const auto& input : tx.inputs )
-      {
-         auto it = std::find_if( utxoSet.begin(), utxoSet.end(),
-                                 [ & ]( const utxo::UTXO& u ) {
-                                    return u.txid == input.txid &&
-                                           u.outputIndex == input.outputIndex;
-                                 } );
+   applyBlockToUTXOSet( block );
 
-         if ( it != utxoSet.end() )
-         {
-            utxoSet.erase( it );
-         }
-      }
-
-      // Add new UTXOs
-      for ( size_t i = 0; i < tx.outputs.size(); ++i )
-      {
-         utxoSet.push_back( { tx.txid, static_cast<int>( i ),
-                              tx.outputs[ i ].amount,
-                              tx.outputs[ i ].address } );
-      }
-   }
-
-   // Update mempool
-   std::vector<Transaction> newPendingTxs;
-   for ( const auto& mempoolTx : pendingTxs )
+   // Update mempool, drop what the block included or spends the same UTXOs.
+   // Children of included transactions stay, conflicts take their
+   // descendants along.
    {
-      bool included    = false;
-      bool conflicting = false;
+      std::lock_guard<std::mutex> lock( pendingTxsMutex );
       for ( const auto& blockTx : block.txs )
       {
-         if ( mempoolTx.txid == blockTx.txid )
-         {
-            included = true;
-            break;
-         }
+         mempool.removeConfirmed( blockTx.txid );
       }
 
-      if ( !included )
+      for ( const auto& outpoint : usedUTXOs )
       {
-         for ( const auto& input : mempoolTx.inputs )
+         if ( const Transaction* conflicting = mempool.spender( outpoint ) )
          {
-            auto utxoKey = std::make_pair( input.txid, input.outputIndex );
-            if ( usedUTXOs.find( utxoKey ) != usedUTXOs.end() )
-            {
-               conflicting = true;
-               break;
-            }
+            mempool.remove( conflicting->txid );
          }
       }
-
-      if ( !included && !conflicting )
-      {
-         newPendingTxs.push_back( mempoolTx );
-      }
    }
 
-   pendingTxs = std::move( newPendingTxs );
-
-   // Index starts at 0 means the new block.index should be equal to the current
-   // chain size
-   if ( block.index != chain.size() )
    {
-      std::cerr << "Invalid block index" << std::endl;
-      return false;
+      std::unique_lock<std::shared_mutex> lock( chainMutex );
+      chain.push_back( block );
    }
 
-   if ( block.prevHash != chain.back().hash )
-   {
-      std::cerr << "Invalid previous hash" << std::endl;
-      return false;
-   }
+   // Whatever we are mining right now builds on the old tip, no need to keep
+   // burning cpu on it
+   miner.cancel();
 
-   if ( !isValidPoW( block.hash, block.difficulty ) )
+   // One append per block instead of rewriting the whole chain, Bitcoin uses
+   // some kind of checkpoints but thats for later TODO: check what checkpoints
+   // are
+   if ( !blockStore.append( block ) )
    {
-      std::cerr << "Invalid proof of work" << std::endl;
-      return false;
+      std::cerr << "Failed to store block " << block.index << std::endl;
    }
 
-   // checkHash
-   if ( block.hash != block.calculateHash() )
+   if ( block.index % UTXO_SNAPSHOT_INTERVAL == 0 )
    {
-      std::cerr << "Invalid Hash" << std::endl;
-      return false;
+      saveUTXOSnapshot( UTXO_SNAPSHOT_FILE );
    }
 
-   chain.push_back( block );
-
-   // Now we cann add it to our json file, Bitcoin uses some kind of checkpoints
-   // but thats for later TODO: check what checkpoints are
-   saveChain( "chain.json" );
-
    return true;
 }
 
 // ----------------------------------------------------------------------------
 bool Blockchain::isTransactionDuplicate( const Transaction& tx ) const
 {
-   auto it = std::find_if( pendingTxs.begin(), pendingTxs.end(),
-                           [ & ]( const auto& pendingTx )
-                           { return tx == pendingTx; } );
+   if ( mempool.contains( tx.txid ) )
+   {
+      std::cout << "Duplicate txid: " << tx.txid << std::endl;
+      return true;
+   }
 
-   if ( it != pendingTxs.end() )
+   const Transaction* it = mempool.findDuplicate( tx );
+   if ( it != nullptr )
    {
       std::cout << "Duplicate sender: " << it->sender
                 << " receiver: " << it->receiver << " Amount: " << it->amount
                 << std::endl;
    }
-   return it != pendingTxs.end();
+   return it != nullptr;
 }
 
 // ----------------------------------------------------------------------------
@@ -444,6 +564,14 @@ bool Blockchain::isValidTransaction( const Transaction& tx ) const
    // TODO's
    // Add balance check ---->requires state tracking
    // Add signature verification
+   // Rewards are never pending, only the node itself creates them when
+   // mining. Keeping them out here lets templates take the pool as it is.
+   if ( tx.isReward )
+   {
+      std::cout << "Invalid TX: reward transactions are not relayed\n";
+      return false;
+   }
+
    if ( tx.sender.empty() || tx.receiver.empty() || tx.amount <= 0 ||
         isTransactionDuplicate( tx ) )
    {
@@ -453,20 +581,33 @@ bool Blockchain::isValidTransaction( const Transaction& tx ) const
       return false;
    }
 
+   // Blocks commit to whole units only, see Transaction::hasExactAmounts
+   if ( !tx.hasExactAmounts() )
+   {
+      std::cout << "Invalid TX: Amount finer than a unit\n";
+      return false;
+   }
+
    // This is now checked in blockchain.addBlock and here to avoid dead
-   // Transactions in pendingTxs
-   // Check UTXO validity and balance
-   double inputSum = 0.0;
+   // Transactions in the mempool
+   // Check UTXO validity and balance, sums in units are exact
+   int64_t inputSum = 0;
    for ( const auto& input : tx.inputs )
    {
-      // Verify UTXO exists in utxoSet
-      auto it = std::find_if( utxoSet.begin(), utxoSet.end(),
-                              [ & ]( const utxo::UTXO& u ) {
-                                 return u.txid == input.txid &&
-                                        u.outputIndex == input.outputIndex;
-                              } );
-
-      if ( it == utxoSet.end() )
+      // Verify the UTXO exists in utxoSet or is an output of a pending
+      // transaction, the mempool keeps such children behind their parents
+      double available = 0.0;
+      if ( const utxo::UTXO* it =
+               utxoSet.find( input.txid, input.outputIndex ) )
+      {
+         available = it->amount;
+      }
+      else if ( const Output* pending =
+                    mempool.output( { input.txid, input.outputIndex } ) )
+      {
+         available = pending->amount;
+      }
+      else
       {
          std::cout << "Invalid TX: UTXO not found for input txid: "
                    << input.txid << " outputIndex: " << input.outputIndex
@@ -475,40 +616,35 @@ bool Blockchain::isValidTransaction( const Transaction& tx ) const
       }
 
       // Verify input amount matches UTXO amount
-      if ( input.amount != it->amount )
+      if ( input.amount != available )
       {
          std::cout << "Invalid TX: Input amount mismatch\n";
          return false;
       }
 
-      inputSum += it->amount;
+      inputSum += serialize::toUnits( available );
 
-      // Check for double-spending in pendingTxs
-      for ( const auto& pendingTx : pendingTxs )
+      // Check for double-spending in the mempool
+      if ( mempool.spender( { input.txid, input.outputIndex } ) != nullptr )
       {
-         for ( const auto& pendingInput : pendingTx.inputs )
-         {
-            if ( pendingInput.txid == input.txid &&
-                 pendingInput.outputIndex == input.outputIndex )
-            {
-               std::cout << "Invalid TX: Double-spend attempt in mempool\n";
-               return false;
-            }
-         }
+         std::cout << "Invalid TX: Double-spend attempt in mempool\n";
+         return false;
       }
    }
 
    // Check balance (outputs + implicit fee)
-   double outputSum = 0.0;
+   int64_t outputSum = 0;
    for ( const auto& output : tx.outputs )
    {
-      outputSum += output.amount;
+      outputSum += serialize::toUnits( output.amount );
    }
 
    if ( inputSum < outputSum )
    {
-      std::cout << "Invalid TX: Insufficient funds (inputSum: " << inputSum
-                << ", outputSum: " << outputSum << ")\n";
+      std::cout << "Invalid TX: Insufficient funds (inputSum: "
+                << serialize::fromUnits( inputSum )
+                << ", outputSum: " << serialize::fromUnits( outputSum )
+                << ")\n";
       return false;
    }
 
@@ -518,6 +654,10 @@ bool Blockchain::isValidTransaction( const Transaction& tx ) const
 // ----------------------------------------------------------------------------
 bool Blockchain::minePendingTransactions( std::string& minerAddress )
 {
+   // Read before the tip, addBlock cancels after appending. A block accepted
+   // while the template is built makes the search return right away.
+   const uint64_t generation = miner.generation();
+
    Block block;
    block.index      = chain.size();
    block.prevHash   = chain.back().hash;
@@ -525,12 +665,14 @@ bool Blockchain::minePendingTransactions( std::string& minerAddress )
    block.txs        = selectTransactions( 10 );
    block.difficulty = calculateExpectedDifficulty();
 
-   double totalFees = 0.0;
+   // Summed in units, the reward output has to be a whole number of units
+   // like every other amount
+   int64_t totalFees = 0;
    for ( const auto& tx : block.txs )
    {
       if ( !tx.isReward )
       {
-         totalFees += tx.fee;
+         totalFees += serialize::toUnits( tx.fee );
       }
    }
 
@@ -549,10 +691,17 @@ bool Blockchain::minePendingTransactions( std::string& minerAddress )
    reward.timestamp = getCurrentTime();
    reward.txid      = "reward_blockIDX_" + std::to_string( block.index ) + "_" +
                  std::to_string( milliseconds );
-   reward.outputs.push_back( { minerAddress, 10.0 + totalFees } );
+   reward.outputs.push_back(
+       { minerAddress,
+         serialize::fromUnits( serialize::toUnits( 10.0 ) + totalFees ) } );
    block.txs.insert( block.txs.begin(), reward );
+   block.merkleRoot = block.calculateMerkleRoot();
 
-   mineBlock( block, block.difficulty );
+   if ( !mineBlock( block, block.difficulty, generation ) )
+   {
+      std::cout << "Mining cancelled, chain tip changed" << std::endl;
+      return false;
+   }
 
    if ( addBlock( block ) )
    {
@@ -586,61 +735,14 @@ std::vector<Transaction> Blockchain::selectTransactions( size_t max )
    // I guess locking is kinda important if stuff is distributed
    std::lock_guard<std::mutex> lock( pendingTxsMutex );
 
-   // TODO, i want to add the blocks with highest fees which the node gets
-   std::vector<Transaction> selected;
-   if ( pendingTxs.size() < max )
-   {
-      max = pendingTxs.size();
-   }
-
-   std::vector<std::pair<int32_t, size_t>> txFeePairs;
-
-   // I dont think this is good for performance
-   // Sorting pendingTxs based on fee, which is calculated but total inputs
-   // minus total outputs for each transaction
-   std::sort( pendingTxs.begin(), pendingTxs.end(),
-              []( auto& tx1, auto& tx2 )
-              {
-                 auto inputAmountTx1 = std::accumulate(
-                     tx1.inputs.begin(), tx1.inputs.end(), 0,
-                     []( auto& i, auto& input ) { return input.amount + i; } );
-
-                 auto outputAmountTx1 =
-                     std::accumulate( tx1.outputs.begin(), tx1.outputs.end(), 0,
-                                      []( auto& i, auto& output )
-                                      { return output.amount + i; } );
-                 auto feeTx1 = inputAmountTx1 - outputAmountTx1;
-
-                 auto inputAmountTx2 = std::accumulate(
-                     tx2.inputs.begin(), tx2.inputs.end(), 0,
-                     []( auto& i, auto& input ) { return input.amount + i; } );
-
-                 auto outputAmountTx2 =
-                     std::accumulate( tx2.outputs.begin(), tx2.outputs.end(), 0,
-                                      []( auto& i, auto& output )
-                                      { return output.amount + i; } );
-                 auto feeTx2 = inputAmountTx2 - outputAmountTx2;
-
-                 return feeTx1 > feeTx2;
-              } );
-
-   for ( size_t i = 0; i < max; ++i )
+   if ( size_t expired = mempool.expire() )
    {
-      if ( pendingTxs[ i ].isReward )
-      {
-         continue;
-      }
-
-      selected.push_back( pendingTxs[ i ] );
+      std::cout << "Expired " << expired << " stale transactions\n";
    }
 
-   // I think i can erase all with rewarded true, first of all only the node
-   // itself calls this function. For blocks received via broadcast we do all
-   // checks in addBlock
-   pendingTxs.erase( std::remove_if( pendingTxs.begin(), pendingTxs.end(),
-                                     []( const auto& tx )
-                                     { return tx.isReward == true; } ),
-                     pendingTxs.end() );
+   // The mempool is kept ordered by ancestor fee rate, a child paying for
+   // its parent brings the parent along. Only the best max are copied.
+   std::vector<Transaction> selected = mempool.select( max );
 
    std::cout << "selected size: " << selected.size() << std::endl;
    return selected;
@@ -662,22 +764,25 @@ json Blockchain::toJson() const
 std::vector<utxo::UTXO>
 Blockchain::getUTXOsForAddress( const std::string& address ) const
 {
-   std::vector<utxo::UTXO> utxoForAddress;
-   for ( const auto& utxo : utxoSet )
-   {
-      if ( utxo.address == address )
-      {
-         utxoForAddress.push_back( utxo );
-      }
-   }
+   return utxoSet.forAddress( address );
+}
 
-   return utxoForAddress;
+// ----------------------------------------------------------------------------
+bool Blockchain::getBlock( size_t height, Block& block ) const
+{
+   return blockStore.read( height, block );
+}
+
+// ----------------------------------------------------------------------------
+int64_t Blockchain::getBlockHeight( const std::string& hash ) const
+{
+   return blockStore.height( hash );
 }
 
 // ----------------------------------------------------------------------------
 int32_t Blockchain::calculateExpectedDifficulty() const
 {
-   if ( chain.size() % 10 == 0 && chain.size() >= 10 )
+   if ( isRetargetHeight( chain.size() ) )
    {
       return adjustDifficulty();
    }
@@ -722,17 +827,17 @@ void Blockchain::recomputeUTXOSet()
 {
    utxoSet.clear();
 
+   // First pass collects every output that is spent somewhere in the chain,
+   // the second one adds all outputs which are not. Both are linear in the
+   // number of inputs and outputs.
+   size_t outputCount = 0;
+
+   std::unordered_set<utxo::Outpoint, utxo::OutpointHash> spent;
    for ( const auto& block : chain )
    {
       for ( const auto& tx : block.txs )
       {
-         // We adding all outputs of a transaction to the utxoSet as we learned
-         // a output becomes a utxo :)
-         for ( int32_t i = 0; i < tx.outputs.size(); ++i )
-         {
-            utxoSet.push_back( { tx.txid, i, tx.outputs[ i ].amount,
-                                 tx.outputs[ i ].address } );
-         }
+         outputCount += tx.outputs.size();
 
          // We skip rewards, they have no inputs
          if ( tx.isReward )
@@ -740,197 +845,232 @@ void Blockchain::recomputeUTXOSet()
             continue;
          }
 
-         // Trying to cleanup the utxoSet by removing all spent inputs
          for ( const auto& input : tx.inputs )
          {
-            // Each input referenes only one utxo
-            utxoSet.erase( std::remove_if( utxoSet.begin(), utxoSet.end(),
-                                           [ & ]( const auto& utxo ) {
-                                              return utxo.txid == input.txid &&
-                                                     utxo.outputIndex ==
-                                                         input.outputIndex;
-                                           } ),
-                           utxoSet.end() );
+            spent.insert( { input.txid, input.outputIndex } );
+         }
+      }
+   }
+
+   utxoSet.reserve( outputCount > spent.size() ? outputCount - spent.size()
+                                               : 0 );
+
+   for ( const auto& block : chain )
+   {
+      for ( const auto& tx : block.txs )
+      {
+         // We adding all outputs of a transaction to the utxoSet as we learned
+         // a output becomes a utxo :)
+         for ( int32_t i = 0; i < tx.outputs.size(); ++i )
+         {
+            if ( spent.count( { tx.txid, i } ) == 0 )
+            {
+               utxoSet.add( { tx.txid, i, tx.outputs[ i ].amount,
+                              tx.outputs[ i ].address } );
+            }
          }
       }
    }
 }
 
 // ----------------------------------------------------------------------------
-bool Blockchain::saveChain( const std::string& fileName ) const
+void Blockchain::recomputeUTXOSet( size_t fromHeight )
 {
-   json j = json::array();
-   for ( const auto& block : chain )
+   if ( fromHeight == 0 )
    {
-      j.push_back( block );
+      recomputeUTXOSet();
+      return;
    }
 
-   std::ofstream file( fileName );
-   if ( !file.is_open() )
+   // utxoSet already reflects the chain up to fromHeight - 1, e.g. loaded from
+   // a snapshot, only the blocks after it get replayed
+   for ( size_t height = fromHeight; height < chain.size(); ++height )
    {
-      std::cerr << "Failed to open file: " << fileName << std::endl;
-      return false;
+      applyBlockToUTXOSet( chain[ height ] );
    }
-
-   file << std::setw( 4 ) << j << std::endl;
-   file.close();
-
-   return true;
 }
 
 // ----------------------------------------------------------------------------
-bool Blockchain::appendBlockToJson( const std::string& fileName ) const
+void Blockchain::applyBlockToUTXOSet( const Block& block )
 {
-   // Check if the file exists
-   bool fileExists = std::filesystem::exists( fileName );
-
-   std::ofstream file;
-   if ( fileExists )
-   {
-      file.open( fileName, std::ios::app );   // Open in append mode
-   }
-   else
+   for ( const auto& tx : block.txs )
    {
-      file.open( fileName );   // Create new file
+      // Remove consumed UTXOs
+      for ( const auto& input : tx.inputs )
+      {
+         utxoSet.spend( input.txid, input.outputIndex );
+      }
+
+      // Add new UTXOs
+      for ( size_t i = 0; i < tx.outputs.size(); ++i )
+      {
+         utxoSet.add( { tx.txid, static_cast<int>( i ), tx.outputs[ i ].amount,
+                        tx.outputs[ i ].address } );
+      }
    }
+}
 
-   if ( !file.is_open() )
+// ----------------------------------------------------------------------------
+// Snapshot layout: magic, version, height, raw tip hash, the UTXO set and a
+// sha256 over everything before it
+namespace
+{
+constexpr uint32_t UTXO_SNAPSHOT_MAGIC   = 0x545a5553;   // "TZUS"
+constexpr uint32_t UTXO_SNAPSHOT_VERSION = 1;
+}   // namespace
+
+// ----------------------------------------------------------------------------
+bool Blockchain::saveUTXOSnapshot( const std::string& fileName ) const
+{
+   crypto::Digest tip;
+   if ( chain.empty() || !crypto::fromHex( chain.back().hash, tip ) )
    {
       return false;
    }
 
-   if ( !fileExists )
-   {
-      // If the file is new, write all blocks
-      for ( const auto& block : chain )
-      {
-         json j = block;
-         file << j.dump() << std::endl;
-      }
-   }
-   else
+   serialize::ByteWriter writer;
+   writer.putU32( UTXO_SNAPSHOT_MAGIC );
+   writer.putU32( UTXO_SNAPSHOT_VERSION );
+   writer.putI32( chain.back().index );
+   writer.putBytes( tip.data(), tip.size() );
+   utxoSet.writeTo( writer );
+
+   const auto& bytes    = writer.data();
+   auto        checksum = crypto::sha256( bytes.data(), bytes.size() );
+   writer.putBytes( checksum.data(), checksum.size() );
+
+   // Written next to the old snapshot and renamed, a crash while writing
+   // leaves the previous snapshot intact
+   const std::string tmpName = fileName + ".tmp";
    {
-      // Find the last block index in the file
-      int lastIndex = -1;
+      std::ofstream file( tmpName, std::ios::binary | std::ios::trunc );
+      if ( !file.is_open() )
       {
-         std::ifstream inFile( fileName );
-         if ( inFile.is_open() )
-         {
-            std::string line;
-
-            while ( std::getline( inFile, line ) )
-            {
-               if ( line.empty() ||
-                    line.find_first_not_of( " \t\r\n" ) == std::string::npos )
-               {
-                  continue;
-               }
-
-               try
-               {
-                  json j = json::parse( line );
-                  if ( j.contains( "index" ) )
-                  {
-                     lastIndex = j[ "index" ];
-                  }
-               }
-               catch ( const std::exception& e )
-               {
-                  // Skip invalid lines
-                  std::cerr << "Skipping invalid JSON line: " << e.what()
-                            << std::endl;
-               }
-            }
-            inFile.close();
-         }
+         std::cerr << "Failed to open file: " << tmpName << std::endl;
+         return false;
       }
 
-      // Append only blocks with index greater than lastIndex
-      for ( const auto& block : chain )
+      file.write( writer.data().data(), writer.data().size() );
+      if ( !file )
       {
-         if ( block.index > lastIndex )
-         {
-            json j = block;
-            file << j.dump() << std::endl;
-         }
+         std::cerr << "Failed to write UTXO snapshot: " << tmpName << std::endl;
+         return false;
       }
    }
 
+   std::error_code ec;
+   std::filesystem::rename( tmpName, fileName, ec );
+   if ( ec )
+   {
+      std::cerr << "Failed to replace UTXO snapshot: " << ec.message()
+                << std::endl;
+      return false;
+   }
+
    return true;
 }
 
 // ----------------------------------------------------------------------------
-std::vector<Block> Blockchain::loadChain( const std::string& fileName ) const
+int32_t Blockchain::loadUTXOSnapshot( const std::string& fileName )
 {
-   std::vector<Block> loadedChain;
-
-   // Check if the file exists
-   if ( !std::filesystem::exists( fileName ) )
+   std::ifstream file( fileName, std::ios::binary );
+   if ( !file.is_open() )
    {
-      std::cerr << "File does not exist: " << fileName << std::endl;
-      return loadedChain;   // Return empty chain
+      return -1;
    }
 
-   // Check if the file is empty
-   if ( std::filesystem::file_size( fileName ) == 0 )
+   std::string data( ( std::istreambuf_iterator<char>( file ) ),
+                     std::istreambuf_iterator<char>() );
+   if ( data.size() < crypto::Digest{}.size() )
    {
-      std::cerr << "File is empty: " << fileName << std::endl;
-      return loadedChain;   // Return empty chain
+      std::cerr << "UTXO snapshot is truncated: " << fileName << std::endl;
+      return -1;
    }
 
-   // Open the file
-   std::ifstream file( fileName );
-   if ( !file.is_open() )
+   const size_t   payloadSize = data.size() - crypto::Digest{}.size();
+   crypto::Digest checksum;
+   std::copy( data.begin() + payloadSize, data.end(), checksum.begin() );
+   if ( crypto::sha256( data.data(), payloadSize ) != checksum )
    {
-      std::cerr << "Failed to open file: " << fileName << std::endl;
-      return loadedChain;   // Return empty chain
+      std::cerr << "UTXO snapshot checksum mismatch: " << fileName << std::endl;
+      return -1;
    }
 
    try
    {
-      // Parse the entire file as a JSON array
-      json j;
-      file >> j;
-      file.close();
-
-      // Ensure it's an array
-      if ( !j.is_array() )
+      serialize::ByteReader reader(
+          std::string_view( data ).substr( 0, payloadSize ) );
+      if ( reader.getU32() != UTXO_SNAPSHOT_MAGIC ||
+           reader.getU32() != UTXO_SNAPSHOT_VERSION )
       {
-         std::cerr << "File does not contain a JSON array: " << fileName
-                   << std::endl;
-         return loadedChain;
+         std::cerr << "Unknown UTXO snapshot format: " << fileName << std::endl;
+         return -1;
       }
 
-      // Convert each JSON object to a Block
-      for ( const auto& blockJson : j )
-      {
-         try
-         {
-            Block block =  blockJson;
-            loadedChain.push_back( block );
-         }
-         catch ( const json::exception& e )
-         {
-            std::cerr << "Error parsing block: " << e.what() << std::endl;
-         }
-      }
+      int32_t        height = reader.getI32();
+      crypto::Digest tip;
+      reader.getBytes( tip.data(), tip.size() );
 
-      // Validate the loaded chain
-      if ( !loadedChain.empty() && !isChainValid( loadedChain ) )
+      // The snapshot has to belong to our chain, a chain taken over from a
+      // peer may have forked before the snapshot height
+      if ( height < 0 || static_cast<size_t>( height ) >= chain.size() ||
+           !crypto::hexEquals( chain[ height ].hash, tip ) )
       {
-         std::cerr << "Loaded chain is invalid" << std::endl;
-         return std::vector<Block>{};
+         std::cout << "UTXO snapshot at height " << height
+                   << " does not match the chain\n";
+         return -1;
       }
+
+      utxoSet.readFrom( reader );
+      return height;
+   }
+   catch ( const std::exception& e )
+   {
+      std::cerr << "Error reading UTXO snapshot: " << e.what() << std::endl;
+      utxoSet.clear();
+      return -1;
    }
-   catch ( const json::exception& e )
+}
+
+// ----------------------------------------------------------------------------
+void Blockchain::restoreUTXOSet()
+{
+   int32_t height = loadUTXOSnapshot( UTXO_SNAPSHOT_FILE );
+   if ( height < 0 )
    {
-      std::cerr << "Error parsing JSON file: " << e.what() << std::endl;
-      file.close();
-      return loadedChain;
+      recomputeUTXOSet();
+      return;
    }
 
-   return loadedChain;
+   std::cout << "Loaded UTXO snapshot at height " << height << ", replaying "
+             << chain.size() - height - 1 << " blocks\n";
+   recomputeUTXOSet( height + 1 );
 }
+
+// ----------------------------------------------------------------------------
+std::vector<Block> Blockchain::loadStoredChain()
+{
+   if ( !blockStore.open() )
+   {
+      return {};
+   }
+
+   if ( blockStore.size() == 0 )
+   {
+      return {};
+   }
+
+   auto storedChain = blockStore.readAll();
+   if ( !isChainValid( storedChain ) )
+   {
+      std::cerr << "Stored chain is invalid" << std::endl;
+      return {};
+   }
+
+   std::cout << "Loaded " << storedChain.size() << " blocks from block store\n";
+   return storedChain;
+}
+
 //std::vector<Block> Blockchain::loadChain( const std::string& fileName ) const
 //{
 //   std::cout << "LOADING CHAIN\n";
@@ -973,8 +1113,9 @@ Block Blockchain::createGenesisBlock()
    genesis.index      = 0;
    genesis.prevHash   = "Mojo";
    genesis.timestamp  = getCurrentTime();
-   genesis.hash       = genesis.calculateHash();
    genesis.difficulty = 4;
+   genesis.merkleRoot = genesis.calculateMerkleRoot();
+   genesis.hash       = genesis.calculateHash();
 
    return genesis;
 }
@@ -2,10 +2,14 @@
 
 #include <chrono>
 #include <mutex>
+#include <shared_mutex>
 #include <utility>
 #include <vector>
 
 #include "Block.h"
+#include "BlockStore.h"
+#include "Mempool.h"
+#include "Miner.h"
 #include "Transaction.h"
 
 // ----------------------------------------------------------------------------
@@ -17,6 +21,12 @@ class Blockchain
    int32_t getEpochDifficulty() const;
    int32_t calculateExpectedDifficulty() const;
    int32_t adjustDifficulty() const;
+   // The rule behind calculateExpectedDifficulty on plain header fields, lets
+   // the header sync check difficulties without having the blocks.
+   // seconds is the time between the block before the retarget height and
+   // the one nine blocks earlier, in the whole seconds the header carries.
+   static bool    isRetargetHeight( size_t height );
+   static int32_t retargetDifficulty( int32_t previous, int64_t seconds );
    bool    addTransaction( const Transaction& tx );
    bool    addBlock( const Block& block );
    void    setupChain();
@@ -49,30 +59,64 @@ class Blockchain
    bool isChainValid( const std::vector<Block>& chain ) const;
    bool minePendingTransactions( std::string& minerAddress );
 
+   // Number of PoW worker threads, 0 means one per hardware thread
+   void setMiningThreads( uint32_t threads );
+   // Byte budget of the mempool, the lowest fee rates are evicted beyond it
+   void setMempoolLimit( size_t bytes );
+
    std::vector<utxo::UTXO>
    getUTXOsForAddress( const std::string& address ) const;
 
+   // Single blocks read from the block store instead of chain, which still
+   // holds every block
+   bool    getBlock( size_t height, Block& block ) const;
+   int64_t getBlockHeight( const std::string& hash ) const;   // -1 if unknown
+
  public:
-   std::vector<utxo::UTXO> utxoSet;
-   std::vector<Block>      chain;
+   utxo::UTXOSet      utxoSet;
+   std::vector<Block> chain;
+   // Held exclusively while chain grows or gets replaced. The node's
+   // endpoints read chain on the server threads and hold it shared.
+   mutable std::shared_mutex chainMutex;
 
  private:
    // Methods for checking
    bool isValidTransaction( const Transaction& tx ) const;
-   bool isValidPoW( const std::string& hash, int difficulty ) const;
+   bool isValidPoW( const crypto::Digest& digest, int difficulty ) const;
+   // Merkle root, hash and PoW, everything not depending on other blocks
+   bool isBlockValid( const Block& block ) const;
    bool isTransactionDuplicate( const Transaction& tx ) const;
-   void mineBlock();
-   void mineBlock( Block& block, int difficulty );
+   bool mineBlock();
+   // generation is the miner's generation() from before block was built
+   bool mineBlock( Block& block, int difficulty, uint64_t generation );
    void recomputeUTXOSet();
+   // Replays only the blocks from fromHeight on top of the current utxoSet
+   void recomputeUTXOSet( size_t fromHeight );
+   void applyBlockToUTXOSet( const Block& block );
    std::vector<Transaction> selectTransactions( size_t max );
 
-   bool               saveChain( const std::string& fileName ) const;
-   bool appendBlockToJson( const std::string& fileName ) const;;
-   std::vector<Block> loadChain( const std::string& fileName ) const;
+   // UTXO snapshot tagged with height and tip hash, lets startup replay only
+   // the blocks after the snapshot instead of the whole chain
+   bool    saveUTXOSnapshot( const std::string& fileName ) const;
+   int32_t loadUTXOSnapshot( const std::string& fileName );
+   void    restoreUTXOSet();
+
+   // Chain from the block store, empty if there is none or it is invalid
+   std::vector<Block> loadStoredChain();
 
+   // Guards the mempool, transactions arrive on the server threads
    std::mutex pendingTxsMutex;
 
+   // Cancelled by addBlock once a block for the current height got accepted
+   Miner miner;
+
+   BlockStore blockStore{ "blocks" };
+
  private:
-   std::vector<Transaction> pendingTxs;       // TODO rename to memPool
-   int                      difficulty = 4;   // Initial difficulty
+   Mempool mempool;
+   int     difficulty = 4;   // Initial difficulty
+
+   static constexpr size_t  MIN_BLOCKS_PER_VALIDATOR = 64;
+   static constexpr int32_t UTXO_SNAPSHOT_INTERVAL   = 100;   // In blocks
+   static constexpr auto    UTXO_SNAPSHOT_FILE       = "utxo.snapshot";
 };
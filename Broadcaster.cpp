@@ -0,0 +1,148 @@
+#include <iostream>
+#include <unordered_set>
+
+#include <json/json.hpp>
+
+#include "Broadcaster.h"
+#include "Serialize.h"
+
+// ----------------------------------------------------------------------------
+Broadcaster::Broadcaster( PeerPool&                       pool_,
+                          const std::vector<std::string>& peers )
+    : pool{ pool_ }
+{
+   outboxes.reserve( peers.size() );
+   for ( const auto& peer : peers )
+   {
+      auto outbox  = std::make_unique<Outbox>();
+      outbox->peer = peer;
+
+      Outbox* box    = outbox.get();
+      outbox->worker = std::thread( [ this, box ]() { run( *box ); } );
+      outboxes.push_back( std::move( outbox ) );
+   }
+}
+
+// ----------------------------------------------------------------------------
+Broadcaster::~Broadcaster()
+{
+   stopping = true;
+   for ( auto& outbox : outboxes )
+   {
+      {
+         // Taking the lock makes sure the worker is either waiting or sees
+         // stopping before it waits
+         std::lock_guard<std::mutex> lock( outbox->mutex );
+      }
+      outbox->ready.notify_one();
+      outbox->worker.join();
+   }
+}
+
+// ----------------------------------------------------------------------------
+void Broadcaster::announce( Kind kind, std::string id, std::string body )
+{
+   auto shared = std::make_shared<const std::string>( std::move( body ) );
+   for ( auto& outbox : outboxes )
+   {
+      {
+         std::lock_guard<std::mutex> lock( outbox->mutex );
+         if ( outbox->messages.size() >= MAX_QUEUED_PER_PEER )
+         {
+            std::cout << "Outbox of " << outbox->peer
+                      << " is full, dropping oldest message\n";
+            outbox->messages.pop_front();
+         }
+
+         outbox->messages.push_back( { kind, id, shared } );
+      }
+
+      outbox->ready.notify_one();
+   }
+}
+
+// ----------------------------------------------------------------------------
+void Broadcaster::run( Outbox& outbox )
+{
+   while ( true )
+   {
+      // Everything queued in the meantime goes out as one announcement
+      std::vector<Message> batch;
+      {
+         std::unique_lock<std::mutex> lock( outbox.mutex );
+         outbox.ready.wait( lock, [ & ]()
+                            { return stopping || !outbox.messages.empty(); } );
+         if ( stopping )
+         {
+            return;
+         }
+
+         while ( !outbox.messages.empty() &&
+                 batch.size() < MAX_INVENTORY_BATCH )
+         {
+            batch.push_back( std::move( outbox.messages.front() ) );
+            outbox.messages.pop_front();
+         }
+      }
+
+      try
+      {
+         send( outbox.peer, batch );
+      }
+      catch ( const std::exception& e )
+      {
+         std::cout << "Something went wrong with a peer maybe offline Peer: "
+                   << outbox.peer << std::endl;
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+void Broadcaster::send( const std::string&          peer,
+                        const std::vector<Message>& batch )
+{
+   nlohmann::json inventory = { { "tx", nlohmann::json::array() },
+                                { "block", nlohmann::json::array() } };
+   for ( const auto& message : batch )
+   {
+      inventory[ message.kind == Kind::Block ? "block" : "tx" ].push_back(
+          message.id );
+   }
+
+   auto res = pool.post( peer, "/inv", inventory.dump(), "application/json" );
+   if ( !res || res->status != 200 )
+   {
+      return;
+   }
+
+   const auto                      wanted = nlohmann::json::parse( res->body );
+   std::unordered_set<std::string> wantedTxs, wantedBlocks;
+   for ( const auto& id : wanted.value( "tx", nlohmann::json::array() ) )
+   {
+      wantedTxs.insert( id.get<std::string>() );
+   }
+   for ( const auto& id : wanted.value( "block", nlohmann::json::array() ) )
+   {
+      wantedBlocks.insert( id.get<std::string>() );
+   }
+
+   // In queue order, a transaction may depend on a block announced before it
+   for ( const auto& message : batch )
+   {
+      const bool isBlock = message.kind == Kind::Block;
+      if ( ( isBlock ? wantedBlocks : wantedTxs ).count( message.id ) == 0 )
+      {
+         continue;
+      }
+
+      // The id lets the peer drop a duplicate before parsing the body
+      const httplib::Headers headers{ { "X-Inventory-Id", message.id } };
+      pool.request( peer,
+                    [ & ]( httplib::Client& cli )
+                    {
+                       return cli.Post( isBlock ? "/block" : "/tx", headers,
+                                        *message.body,
+                                        serialize::COMPACT_CONTENT_TYPE );
+                    } );
+   }
+}
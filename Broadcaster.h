@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PeerPool.h"
+
+// ----------------------------------------------------------------------------
+// Outbound messages to the peers. Every peer has its own bounded queue and
+// worker thread, so broadcasting never blocks the caller and a slow or dead
+// peer only delays its own messages. Timeouts come from the PeerPool.
+//
+// Blocks and transactions are gossiped by inventory. The worker posts only the
+// ids of everything queued to /inv, the peer answers with the ids it has not
+// seen yet and only those are posted in full to /block or /tx.
+class Broadcaster
+{
+ public:
+   enum class Kind
+   {
+      Transaction,
+      Block,
+   };
+
+   Broadcaster( PeerPool& pool, const std::vector<std::string>& peers );
+   ~Broadcaster();
+
+   Broadcaster( const Broadcaster& )            = delete;
+   Broadcaster& operator=( const Broadcaster& ) = delete;
+
+   // Queues the announcement of id for every peer, body is the compact
+   // encoding sent to peers asking for it. A full queue drops its oldest
+   // message, newer blocks and transactions matter more.
+   void announce( Kind kind, std::string id, std::string body );
+
+ private:
+   struct Message
+   {
+      Kind                               kind;
+      std::string                        id;
+      std::shared_ptr<const std::string> body;   // Shared by all peers
+   };
+
+   struct Outbox
+   {
+      std::string             peer;
+      std::mutex              mutex;
+      std::condition_variable ready;
+      std::deque<Message>     messages;
+      std::thread             worker;
+   };
+
+   void run( Outbox& outbox );
+   // Announces a batch to the peer and sends what it asked for
+   void send( const std::string& peer, const std::vector<Message>& batch );
+
+   static constexpr size_t MAX_QUEUED_PER_PEER = 256;
+   static constexpr size_t MAX_INVENTORY_BATCH = 128;
+
+   PeerPool&                            pool;
+   std::vector<std::unique_ptr<Outbox>> outboxes;
+   std::atomic<bool>                    stopping{ false };
+};
@@ -0,0 +1,139 @@
+// SHA256_CTX is deprecated since OpenSSL 3 in favour of EVP, but EVP contexts
+// can not be copied cheaply which defeats the midstate
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <cstring>
+
+#include "Hash.h"
+
+namespace crypto
+{
+// ----------------------------------------------------------------------------
+Sha256::Sha256()
+{
+   SHA256_Init( &ctx );
+}
+
+// ----------------------------------------------------------------------------
+void Sha256::update( const void* data, size_t length )
+{
+   SHA256_Update( &ctx, data, length );
+}
+
+// ----------------------------------------------------------------------------
+void Sha256::update( const std::string& data )
+{
+   update( data.data(), data.size() );
+}
+
+// ----------------------------------------------------------------------------
+Digest Sha256::finalize() const
+{
+   // Finalizing a copy keeps this object usable as midstate
+   SHA256_CTX copy = ctx;
+   Digest     digest;
+   SHA256_Final( digest.data(), &copy );
+
+   return digest;
+}
+
+// ----------------------------------------------------------------------------
+Digest sha256( const void* data, size_t length )
+{
+   Digest digest;
+   SHA256( reinterpret_cast<const unsigned char*>( data ), length,
+           digest.data() );
+
+   return digest;
+}
+
+// ----------------------------------------------------------------------------
+std::string toHex( const Digest& digest )
+{
+   static constexpr char digits[] = "0123456789abcdef";
+
+   std::string hex( digest.size() * 2, '0' );
+   for ( size_t i = 0; i < digest.size(); ++i )
+   {
+      hex[ 2 * i ]     = digits[ digest[ i ] >> 4 ];
+      hex[ 2 * i + 1 ] = digits[ digest[ i ] & 0x0f ];
+   }
+
+   return hex;
+}
+// ----------------------------------------------------------------------------
+bool fromHex( const std::string& hex, Digest& digest )
+{
+   if ( hex.size() != digest.size() * 2 )
+   {
+      return false;
+   }
+
+   auto nibble = []( char c ) -> int
+   {
+      if ( c >= '0' && c <= '9' )
+         return c - '0';
+      if ( c >= 'a' && c <= 'f' )
+         return c - 'a' + 10;
+      if ( c >= 'A' && c <= 'F' )
+         return c - 'A' + 10;
+      return -1;
+   };
+
+   for ( size_t i = 0; i < digest.size(); ++i )
+   {
+      int high = nibble( hex[ 2 * i ] );
+      int low  = nibble( hex[ 2 * i + 1 ] );
+      if ( high < 0 || low < 0 )
+      {
+         return false;
+      }
+
+      digest[ i ] = static_cast<unsigned char>( ( high << 4 ) | low );
+   }
+
+   return true;
+}
+// ----------------------------------------------------------------------------
+bool hexEquals( const std::string& hex, const Digest& digest )
+{
+   Digest decoded;
+   return fromHex( hex, decoded ) && decoded == digest;
+}
+
+// ----------------------------------------------------------------------------
+size_t DigestHash::operator()( const Digest& digest ) const
+{
+   size_t value;
+   std::memcpy( &value, digest.data(), sizeof( value ) );
+   return value;
+}
+
+// ----------------------------------------------------------------------------
+bool meetsDifficulty( const Digest& digest, int difficulty )
+{
+   const int bits = difficulty * 4;
+   if ( bits <= 0 )
+   {
+      return true;
+   }
+
+   if ( bits > static_cast<int>( digest.size() * 8 ) )
+   {
+      return false;
+   }
+
+   // Full zero bytes first, then the remaining high nibble if any
+   const int fullBytes = bits / 8;
+   for ( int i = 0; i < fullBytes; ++i )
+   {
+      if ( digest[ i ] != 0 )
+      {
+         return false;
+      }
+   }
+
+   const int rest = bits % 8;
+   return rest == 0 || ( digest[ fullBytes ] >> ( 8 - rest ) ) == 0;
+}
+};   // namespace crypto
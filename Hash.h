@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <openssl/sha.h>
+
+namespace crypto
+{
+using Digest = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+
+// ----------------------------------------------------------------------------
+// Incremental SHA-256. The state is a plain value, copying it after feeding a
+// common prefix gives the midstate every following hash can start from.
+class Sha256
+{
+ public:
+   Sha256();
+
+   void   update( const void* data, size_t length );
+   void   update( const std::string& data );
+   Digest finalize() const;
+
+ private:
+   SHA256_CTX ctx;
+};
+
+// ----------------------------------------------------------------------------
+Digest      sha256( const void* data, size_t length );
+std::string toHex( const Digest& digest );
+
+// Returns false if hex is not exactly 64 hex characters
+bool fromHex( const std::string& hex, Digest& digest );
+
+// Compares a hex encoded hash with a digest without encoding the digest
+bool hexEquals( const std::string& hex, const Digest& digest );
+
+// Digests are uniformly distributed, their first bytes are a good enough hash
+struct DigestHash
+{
+   size_t operator()( const Digest& digest ) const;
+};
+
+// ----------------------------------------------------------------------------
+// Proof of work works on the raw digest. The difficulty counts leading zero
+// hex digits, so it is checked as difficulty * 4 leading zero bits.
+bool meetsDifficulty( const Digest& digest, int difficulty );
+
+};   // namespace crypto
@@ -0,0 +1,475 @@
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "JsonReader.h"
+
+namespace jsonreader
+{
+namespace
+{
+enum class Frame
+{
+   Block,
+   Transactions,
+   Transaction,
+   Inputs,
+   Input,
+   Outputs,
+   Output,
+   Skip,   // Anything below an unknown key
+};
+
+enum Field : uint32_t
+{
+   Index,
+   PrevHash,
+   MerkleRoot,
+   Hash,
+   Transactions,
+   Nonce,
+   Difficulty,
+   Timestamp,
+   TxId,
+   Sender,
+   Receiver,
+   Amount,
+   Fee,
+   IsReward,
+   Inputs,
+   Outputs,
+   OutputIndex,
+   Signature,
+   Address,
+   Unknown,
+};
+
+constexpr uint32_t bit( Field field )
+{
+   return 1u << field;
+}
+
+// Keys from_json requires for every object
+constexpr uint32_t BLOCK_FIELDS = bit( Index ) | bit( PrevHash ) |
+                                  bit( MerkleRoot ) | bit( Hash ) |
+                                  bit( Transactions ) | bit( Nonce ) |
+                                  bit( Difficulty ) | bit( Timestamp );
+constexpr uint32_t TRANSACTION_FIELDS =
+    bit( TxId ) | bit( Sender ) | bit( Receiver ) | bit( Amount ) |
+    bit( Fee ) | bit( IsReward ) | bit( Inputs ) | bit( Outputs ) |
+    bit( Timestamp );
+constexpr uint32_t INPUT_FIELDS =
+    bit( TxId ) | bit( OutputIndex ) | bit( Amount ) | bit( Signature );
+constexpr uint32_t OUTPUT_FIELDS = bit( Address ) | bit( Amount );
+
+// ----------------------------------------------------------------------------
+Field lookup( Frame frame, const std::string& key )
+{
+   struct Entry
+   {
+      const char* key;
+      Field       field;
+   };
+
+   static const std::vector<Entry> block = {
+       { "index", Index },
+       { "prevHash", PrevHash },
+       { "merkleRoot", MerkleRoot },
+       { "hash", Hash },
+       { "transactions", Transactions },
+       { "nonce", Nonce },
+       { "difficulty", Difficulty },
+       { "timestamp", Timestamp } };
+   static const std::vector<Entry> transaction = {
+       { "txid", TxId },         { "sender", Sender },
+       { "receiver", Receiver }, { "amount", Amount },
+       { "fee", Fee },           { "isReward", IsReward },
+       { "inputs", Inputs },     { "outputs", Outputs },
+       { "timestamp", Timestamp } };
+   static const std::vector<Entry> input = { { "txid", TxId },
+                                             { "outputIndex", OutputIndex },
+                                             { "amount", Amount },
+                                             { "signature", Signature } };
+   static const std::vector<Entry> output = { { "address", Address },
+                                              { "amount", Amount } };
+
+   const std::vector<Entry>* entries = nullptr;
+   switch ( frame )
+   {
+   case Frame::Block: entries = &block; break;
+   case Frame::Transaction: entries = &transaction; break;
+   case Frame::Input: entries = &input; break;
+   case Frame::Output: entries = &output; break;
+   default: return Unknown;
+   }
+
+   for ( const auto& entry : *entries )
+   {
+      if ( key == entry.key )
+      {
+         return entry.field;
+      }
+   }
+
+   return Unknown;
+}
+
+// ----------------------------------------------------------------------------
+// Any json number, converted like get_to converts it
+struct Number
+{
+   enum class Kind
+   {
+      Integer,
+      Unsigned,
+      Float
+   } kind;
+
+   int64_t  signedValue   = 0;
+   uint64_t unsignedValue = 0;
+   double   floatValue    = 0;
+
+   template <typename T>
+   T as() const
+   {
+      switch ( kind )
+      {
+      case Kind::Integer: return static_cast<T>( signedValue );
+      case Kind::Unsigned: return static_cast<T>( unsignedValue );
+      default: return static_cast<T>( floatValue );
+      }
+   }
+};
+
+// ----------------------------------------------------------------------------
+class Reader : public nlohmann::json_sax<json>
+{
+ public:
+   Reader( Block* block_, Transaction* transaction_ )
+       : block{ block_ }, transaction{ transaction_ }
+   {
+   }
+
+   bool null() override
+   {
+      if ( scalar() )
+      {
+         throw std::invalid_argument( "Unexpected null for " + key_ );
+      }
+
+      return true;
+   }
+   bool boolean( bool val ) override
+   {
+      if ( !scalar() )
+      {
+         return true;
+      }
+
+      if ( field != IsReward )
+      {
+         throw std::invalid_argument( "Unexpected boolean for " + key_ );
+      }
+
+      currentTransaction().isReward = val;
+      return true;
+   }
+   bool number_integer( number_integer_t val ) override
+   {
+      Number number{ Number::Kind::Integer };
+      number.signedValue = val;
+      return setNumber( number );
+   }
+   bool number_unsigned( number_unsigned_t val ) override
+   {
+      Number number{ Number::Kind::Unsigned };
+      number.unsignedValue = val;
+      return setNumber( number );
+   }
+   bool number_float( number_float_t val, const string_t& ) override
+   {
+      Number number{ Number::Kind::Float };
+      number.floatValue = val;
+      return setNumber( number );
+   }
+   bool string( string_t& val ) override
+   {
+      if ( !scalar() )
+      {
+         return true;
+      }
+
+      target( field ) = std::move( val );
+      return true;
+   }
+   bool binary( binary_t& ) override
+   {
+      throw std::invalid_argument( "Unexpected binary value" );
+   }
+
+   bool start_object( std::size_t ) override
+   {
+      if ( stack.empty() )
+      {
+         push( block ? Frame::Block : Frame::Transaction );
+         return true;
+      }
+
+      switch ( stack.back().frame )
+      {
+      case Frame::Transactions:
+         block->txs.emplace_back();
+         push( Frame::Transaction );
+         break;
+      case Frame::Inputs:
+         currentTransaction().inputs.emplace_back();
+         push( Frame::Input );
+         break;
+      case Frame::Outputs:
+         currentTransaction().outputs.emplace_back();
+         push( Frame::Output );
+         break;
+      case Frame::Skip: push( Frame::Skip ); break;
+      default:
+         if ( field != Unknown )
+         {
+            throw std::invalid_argument( "Unexpected object for " + key_ );
+         }
+
+         push( Frame::Skip );
+      }
+
+      return true;
+   }
+   bool key( string_t& val ) override
+   {
+      key_  = std::move( val );
+      field = stack.back().frame == Frame::Skip
+                  ? Unknown
+                  : lookup( stack.back().frame, key_ );
+      return true;
+   }
+   bool end_object() override
+   {
+      static const auto required = []( Frame frame )
+      {
+         switch ( frame )
+         {
+         case Frame::Block: return BLOCK_FIELDS;
+         case Frame::Transaction: return TRANSACTION_FIELDS;
+         case Frame::Input: return INPUT_FIELDS;
+         case Frame::Output: return OUTPUT_FIELDS;
+         default: return 0u;
+         }
+      };
+
+      const auto& level = stack.back();
+      if ( ( level.seen & required( level.frame ) ) !=
+           required( level.frame ) )
+      {
+         throw std::invalid_argument( "Missing key in json object" );
+      }
+
+      pop();
+      return true;
+   }
+
+   bool start_array( std::size_t ) override
+   {
+      if ( stack.empty() )
+      {
+         throw std::invalid_argument( "Expected a json object" );
+      }
+
+      const Frame frame = stack.back().frame;
+      if ( frame == Frame::Skip || isArray( frame ) || field == Unknown )
+      {
+         if ( isArray( frame ) )
+         {
+            throw std::invalid_argument( "Unexpected nested array" );
+         }
+
+         push( Frame::Skip );
+         return true;
+      }
+
+      stack.back().seen |= bit( field );
+      switch ( field )
+      {
+      case Transactions:
+         block->txs.clear();
+         push( Frame::Transactions );
+         break;
+      case Inputs:
+         currentTransaction().inputs.clear();
+         push( Frame::Inputs );
+         break;
+      case Outputs:
+         currentTransaction().outputs.clear();
+         push( Frame::Outputs );
+         break;
+      default: throw std::invalid_argument( "Unexpected array for " + key_ );
+      }
+
+      return true;
+   }
+   bool end_array() override
+   {
+      pop();
+      return true;
+   }
+
+   bool parse_error( std::size_t, const std::string&,
+                     const nlohmann::detail::exception& ex ) override
+   {
+      throw std::invalid_argument( ex.what() );
+   }
+
+ private:
+   struct Level
+   {
+      Frame    frame;
+      uint32_t seen = 0;   // Bits of the known keys found so far
+   };
+
+   static bool isArray( Frame frame )
+   {
+      return frame == Frame::Transactions || frame == Frame::Inputs ||
+             frame == Frame::Outputs;
+   }
+
+   void push( Frame frame ) { stack.push_back( { frame } ); }
+   void pop()
+   {
+      stack.pop_back();
+      field = Unknown;
+   }
+
+   // True if the value belongs to a known key and has to be stored. The key
+   // is marked as seen.
+   bool scalar()
+   {
+      if ( stack.empty() )
+      {
+         throw std::invalid_argument( "Expected a json object" );
+      }
+
+      const Frame frame = stack.back().frame;
+      if ( isArray( frame ) )
+      {
+         throw std::invalid_argument( "Unexpected value in array" );
+      }
+
+      if ( frame == Frame::Skip || field == Unknown )
+      {
+         return false;
+      }
+
+      stack.back().seen |= bit( field );
+      return true;
+   }
+
+   bool setNumber( const Number& number )
+   {
+      if ( !scalar() )
+      {
+         return true;
+      }
+
+      const Frame frame = stack.back().frame;
+      switch ( field )
+      {
+      case Index: block->index = number.as<int32_t>(); break;
+      case Nonce: block->nonce = number.as<uint64_t>(); break;
+      case Difficulty: block->difficulty = number.as<int32_t>(); break;
+      case Timestamp:
+      {
+         const auto timestamp = std::chrono::system_clock::time_point(
+             std::chrono::seconds( number.as<int64_t>() ) );
+         if ( frame == Frame::Block )
+         {
+            block->timestamp = timestamp;
+         }
+         else
+         {
+            currentTransaction().timestamp = timestamp;
+         }
+         break;
+      }
+      case Amount:
+         if ( frame == Frame::Input )
+         {
+            currentTransaction().inputs.back().amount = number.as<double>();
+         }
+         else if ( frame == Frame::Output )
+         {
+            currentTransaction().outputs.back().amount = number.as<double>();
+         }
+         else
+         {
+            currentTransaction().amount = number.as<double>();
+         }
+         break;
+      case Fee: currentTransaction().fee = number.as<double>(); break;
+      case OutputIndex:
+         currentTransaction().inputs.back().outputIndex = number.as<int>();
+         break;
+      default: throw std::invalid_argument( "Unexpected number for " + key_ );
+      }
+
+      return true;
+   }
+
+   // The string member field refers to in the current object
+   std::string& target( Field field_ )
+   {
+      const Frame frame = stack.back().frame;
+      switch ( field_ )
+      {
+      case PrevHash: return block->prevHash;
+      case MerkleRoot: return block->merkleRoot;
+      case Hash: return block->hash;
+      case TxId:
+         return frame == Frame::Input
+                    ? currentTransaction().inputs.back().txid
+                    : currentTransaction().txid;
+      case Sender: return currentTransaction().sender;
+      case Receiver: return currentTransaction().receiver;
+      case Signature: return currentTransaction().inputs.back().signature;
+      case Address: return currentTransaction().outputs.back().address;
+      default: throw std::invalid_argument( "Unexpected string for " + key_ );
+      }
+   }
+
+   Transaction& currentTransaction()
+   {
+      return block ? block->txs.back() : *transaction;
+   }
+
+   Block*       block;
+   Transaction* transaction;
+
+   std::vector<Level> stack;
+   std::string        key_;
+   Field              field = Unknown;
+};
+}   // namespace
+
+// ----------------------------------------------------------------------------
+Block parseBlock( std::string_view body )
+{
+   Block  block;
+   Reader reader( &block, nullptr );
+   json::sax_parse( body.begin(), body.end(), &reader );
+   return block;
+}
+
+// ----------------------------------------------------------------------------
+Transaction parseTransaction( std::string_view body )
+{
+   Transaction tx;
+   Reader      reader( nullptr, &tx );
+   json::sax_parse( body.begin(), body.end(), &reader );
+   return tx;
+}
+};   // namespace jsonreader
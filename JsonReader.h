@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string_view>
+
+#include "Block.h"
+#include "Transaction.h"
+
+// ----------------------------------------------------------------------------
+// Parses json bodies straight into a Block or Transaction without building a
+// json DOM first, strings are moved out of the parser instead of being copied
+// twice. Accepts what from_json accepts, unknown keys are skipped. Throws on
+// malformed json, missing keys or values of the wrong type.
+namespace jsonreader
+{
+Block       parseBlock( std::string_view body );
+Transaction parseTransaction( std::string_view body );
+};   // namespace jsonreader
@@ -0,0 +1,574 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "Mempool.h"
+
+// ----------------------------------------------------------------------------
+Mempool::Mempool( size_t maxBytes_ ) : maxBytes{ maxBytes_ } {}
+
+// ----------------------------------------------------------------------------
+bool Mempool::add( const Transaction& tx )
+{
+   if ( tx.isReward || byTxid.count( tx.txid ) )
+   {
+      return false;
+   }
+
+   const double txFee = fee( tx );
+   const size_t bytes = tx.serialize().size();
+   const double rate  = txFee / static_cast<double>( bytes );
+   if ( rate < minFeeRate() )
+   {
+      std::cout << "Mempool: fee rate " << rate << " below minimum "
+                << minFeeRate() << std::endl;
+      return false;
+   }
+
+   Entry entry;
+   entry.tx = tx;
+   for ( const auto& input : tx.inputs )
+   {
+      auto parent = byTxid.find( input.txid );
+      if ( parent != byTxid.end() )
+      {
+         entry.parents.insert( parent->second->first );
+      }
+   }
+
+   const std::set<uint64_t> ancestors = ancestorsOf( entry );
+   if ( ancestors.size() + 1 > MAX_ANCESTORS )
+   {
+      std::cout << "Mempool: too many pending ancestors ("
+                << ancestors.size() << ")" << std::endl;
+      return false;
+   }
+
+   Package ancestorPackage{ txFee, bytes, 1 };
+   for ( uint64_t sequence : ancestors )
+   {
+      const Entry& ancestor = entries.at( sequence );
+      if ( ancestor.descendants.count + 1 > MAX_DESCENDANTS )
+      {
+         std::cout << "Mempool: ancestor " << ancestor.tx.txid
+                   << " has too many pending descendants" << std::endl;
+         return false;
+      }
+
+      ancestorPackage.fee += ancestor.fee;
+      ancestorPackage.bytes += ancestor.bytes;
+      ++ancestorPackage.count;
+   }
+
+   const uint64_t sequence = nextSequence++;
+   entry.sequence          = sequence;
+
+   auto   it    = entries.emplace( sequence, std::move( entry ) ).first;
+   Entry& added = it->second;
+   added.added  = Clock::now();
+   added.usage  = entryUsage( added.tx, added.parents.size() );
+   added.fee    = txFee;
+   added.bytes  = bytes;
+   usage += added.usage;
+
+   setAncestors( added, ancestorPackage );
+   setDescendants( added, { txFee, bytes, 1 } );
+   for ( uint64_t ancestorSequence : ancestors )
+   {
+      Entry&  ancestor = entries.at( ancestorSequence );
+      Package package  = ancestor.descendants;
+      package.fee += txFee;
+      package.bytes += bytes;
+      ++package.count;
+      setDescendants( ancestor, package );
+   }
+   for ( uint64_t parent : added.parents )
+   {
+      entries.at( parent ).children.insert( sequence );
+   }
+
+   byTxid.emplace( tx.txid, it );
+   byContent.emplace( contentHash( tx ), &added.tx );
+   for ( const auto& input : tx.inputs )
+   {
+      spentBy.emplace( utxo::Outpoint{ input.txid, input.outputIndex },
+                       &added.tx );
+   }
+
+   trim();
+   return byTxid.count( tx.txid ) > 0;
+}
+
+// ----------------------------------------------------------------------------
+bool Mempool::remove( const std::string& txid )
+{
+   auto it = byTxid.find( txid );
+   if ( it == byTxid.end() )
+   {
+      return false;
+   }
+
+   eraseWithDescendants( it->second );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+bool Mempool::removeConfirmed( const std::string& txid )
+{
+   auto it = byTxid.find( txid );
+   if ( it == byTxid.end() )
+   {
+      return false;
+   }
+
+   erase( it->second );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+void Mempool::clear()
+{
+   entries.clear();
+   byTxid.clear();
+   byAncestorScore.clear();
+   byDescendantScore.clear();
+   byContent.clear();
+   spentBy.clear();
+   usage = 0;
+}
+
+// ----------------------------------------------------------------------------
+size_t Mempool::expire()
+{
+   const auto cutoff  = Clock::now() - MAX_AGE;
+   size_t     expired = 0;
+   while ( !entries.empty() && entries.begin()->second.added < cutoff )
+   {
+      expired += eraseWithDescendants( entries.begin() );
+   }
+
+   return expired;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<Transaction> Mempool::select( size_t max ) const
+{
+   // Once some ancestors of a transaction are selected only the rest of its
+   // package counts. Those transactions move from byAncestorScore to a
+   // second index with their remaining totals, the best of both is next.
+   std::unordered_map<uint64_t, Package> modified;
+   std::set<Priority>                    modifiedScore;
+   std::set<uint64_t>                    included;
+   std::set<uint64_t>                    failed;   // Package did not fit
+
+   // Packages only fail to fit once the template is nearly full, there is no
+   // point in trying the whole pool then
+   constexpr size_t MAX_FAILURES = 100;
+   size_t           failures     = 0;
+
+   std::vector<Transaction> selected;
+   selected.reserve( std::min( max, entries.size() ) );
+
+   auto next = byAncestorScore.begin();
+   while ( selected.size() < max && failures < MAX_FAILURES )
+   {
+      while ( next != byAncestorScore.end() &&
+              ( included.count( next->sequence ) ||
+                modified.count( next->sequence ) ||
+                failed.count( next->sequence ) ) )
+      {
+         ++next;
+      }
+
+      uint64_t candidate;
+      if ( !modifiedScore.empty() &&
+           ( next == byAncestorScore.end() || *modifiedScore.begin() < *next ) )
+      {
+         candidate = modifiedScore.begin()->sequence;
+         modifiedScore.erase( modifiedScore.begin() );
+      }
+      else if ( next != byAncestorScore.end() )
+      {
+         candidate = next->sequence;
+         ++next;
+      }
+      else
+      {
+         break;
+      }
+
+      // Ascending sequences, parents come first
+      std::set<uint64_t> package = ancestorsOf( entries.at( candidate ) );
+      for ( auto it = package.begin(); it != package.end(); )
+      {
+         it = included.count( *it ) ? package.erase( it ) : std::next( it );
+      }
+      package.insert( candidate );
+
+      if ( selected.size() + package.size() > max )
+      {
+         failed.insert( candidate );
+         ++failures;
+         continue;
+      }
+
+      failures = 0;
+      for ( uint64_t sequence : package )
+      {
+         const Entry& entry = entries.at( sequence );
+         selected.push_back( entry.tx );
+         included.insert( sequence );
+
+         auto pending = modified.find( sequence );
+         if ( pending != modified.end() )
+         {
+            modifiedScore.erase(
+                Priority{ pending->second.feeRate(), pending->first } );
+         }
+      }
+
+      for ( uint64_t sequence : package )
+      {
+         const Entry& entry = entries.at( sequence );
+         for ( uint64_t descendant : descendantsOf( entry ) )
+         {
+            if ( included.count( descendant ) || failed.count( descendant ) )
+            {
+               continue;
+            }
+
+            auto [it, inserted] = modified.try_emplace(
+                descendant, entries.at( descendant ).ancestors );
+            if ( !inserted )
+            {
+               modifiedScore.erase(
+                   Priority{ it->second.feeRate(), descendant } );
+            }
+
+            it->second.fee -= entry.fee;
+            it->second.bytes -= entry.bytes;
+            --it->second.count;
+            modifiedScore.insert(
+                Priority{ it->second.feeRate(), descendant } );
+         }
+      }
+   }
+
+   return selected;
+}
+
+// ----------------------------------------------------------------------------
+bool Mempool::contains( const std::string& txid ) const
+{
+   return byTxid.count( txid ) > 0;
+}
+
+// ----------------------------------------------------------------------------
+const Transaction* Mempool::findDuplicate( const Transaction& tx ) const
+{
+   auto it = byContent.find( contentHash( tx ) );
+   return it != byContent.end() ? it->second : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+const Transaction* Mempool::spender( const utxo::Outpoint& outpoint ) const
+{
+   auto it = spentBy.find( outpoint );
+   return it != spentBy.end() ? it->second : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+const Output* Mempool::output( const utxo::Outpoint& outpoint ) const
+{
+   auto it = byTxid.find( outpoint.txid );
+   if ( it == byTxid.end() )
+   {
+      return nullptr;
+   }
+
+   const auto& outputs = it->second->second.tx.outputs;
+   if ( outpoint.outputIndex < 0 ||
+        static_cast<size_t>( outpoint.outputIndex ) >= outputs.size() )
+   {
+      return nullptr;
+   }
+
+   return &outputs[ outpoint.outputIndex ];
+}
+
+// ----------------------------------------------------------------------------
+size_t Mempool::size() const
+{
+   return entries.size();
+}
+
+// ----------------------------------------------------------------------------
+size_t Mempool::memoryUsage() const
+{
+   return usage;
+}
+
+// ----------------------------------------------------------------------------
+void Mempool::setMaxBytes( size_t maxBytes_ )
+{
+   maxBytes = maxBytes_;
+   trim();
+}
+
+// ----------------------------------------------------------------------------
+double Mempool::minFeeRate() const
+{
+   if ( rollingMinFeeRate == 0.0 )
+   {
+      return 0.0;
+   }
+
+   const double halfLives =
+       std::chrono::duration<double>( Clock::now() - lastMinFeeRaise ) /
+       MIN_FEE_HALF_LIFE;
+   const double rate = rollingMinFeeRate * std::exp2( -halfLives );
+
+   // Below the increment it is only noise, the pool is open to everyone again
+   return rate < INCREMENTAL_FEE_RATE / 2 ? 0.0 : rate;
+}
+
+// ----------------------------------------------------------------------------
+std::set<uint64_t> Mempool::ancestorsOf( const Entry& entry ) const
+{
+   std::set<uint64_t>    ancestors;
+   std::vector<uint64_t> open( entry.parents.begin(), entry.parents.end() );
+   while ( !open.empty() )
+   {
+      const uint64_t sequence = open.back();
+      open.pop_back();
+      if ( ancestors.insert( sequence ).second )
+      {
+         const auto& parents = entries.at( sequence ).parents;
+         open.insert( open.end(), parents.begin(), parents.end() );
+      }
+   }
+
+   return ancestors;
+}
+
+// ----------------------------------------------------------------------------
+std::set<uint64_t> Mempool::descendantsOf( const Entry& entry ) const
+{
+   std::set<uint64_t>    descendants;
+   std::vector<uint64_t> open( entry.children.begin(), entry.children.end() );
+   while ( !open.empty() )
+   {
+      const uint64_t sequence = open.back();
+      open.pop_back();
+      if ( descendants.insert( sequence ).second )
+      {
+         const auto& children = entries.at( sequence ).children;
+         open.insert( open.end(), children.begin(), children.end() );
+      }
+   }
+
+   return descendants;
+}
+
+// ----------------------------------------------------------------------------
+void Mempool::setAncestors( Entry& entry, const Package& package )
+{
+   // A fresh entry is not indexed yet
+   if ( entry.ancestors.count > 0 )
+   {
+      byAncestorScore.erase(
+          Priority{ entry.ancestors.feeRate(), entry.sequence } );
+   }
+
+   entry.ancestors = package;
+   byAncestorScore.insert( Priority{ package.feeRate(), entry.sequence } );
+}
+
+// ----------------------------------------------------------------------------
+void Mempool::setDescendants( Entry& entry, const Package& package )
+{
+   if ( entry.descendants.count > 0 )
+   {
+      byDescendantScore.erase(
+          Priority{ entry.descendants.feeRate(), entry.sequence } );
+   }
+
+   entry.descendants = package;
+   byDescendantScore.insert( Priority{ package.feeRate(), entry.sequence } );
+}
+
+// ----------------------------------------------------------------------------
+Mempool::Entries::iterator Mempool::erase( Entries::iterator it )
+{
+   Entry&             entry = it->second;
+   const Transaction& tx    = entry.tx;
+
+   // What stays loses this transaction from its totals
+   for ( uint64_t sequence : ancestorsOf( entry ) )
+   {
+      Entry&  ancestor = entries.at( sequence );
+      Package package  = ancestor.descendants;
+      package.fee -= entry.fee;
+      package.bytes -= entry.bytes;
+      --package.count;
+      setDescendants( ancestor, package );
+   }
+   for ( uint64_t sequence : descendantsOf( entry ) )
+   {
+      Entry&  descendant = entries.at( sequence );
+      Package package    = descendant.ancestors;
+      package.fee -= entry.fee;
+      package.bytes -= entry.bytes;
+      --package.count;
+      setAncestors( descendant, package );
+   }
+
+   for ( uint64_t parent : entry.parents )
+   {
+      entries.at( parent ).children.erase( entry.sequence );
+   }
+   for ( uint64_t child : entry.children )
+   {
+      entries.at( child ).parents.erase( entry.sequence );
+   }
+
+   for ( const auto& input : tx.inputs )
+   {
+      // Only the entries of this transaction, add does not reject conflicts
+      auto spent =
+          spentBy.find( utxo::Outpoint{ input.txid, input.outputIndex } );
+      if ( spent != spentBy.end() && spent->second == &tx )
+      {
+         spentBy.erase( spent );
+      }
+   }
+
+   auto duplicate = byContent.find( contentHash( tx ) );
+   if ( duplicate != byContent.end() && duplicate->second == &tx )
+   {
+      byContent.erase( duplicate );
+   }
+
+   byTxid.erase( tx.txid );
+   byAncestorScore.erase(
+       Priority{ entry.ancestors.feeRate(), entry.sequence } );
+   byDescendantScore.erase(
+       Priority{ entry.descendants.feeRate(), entry.sequence } );
+   usage -= entry.usage;
+   return entries.erase( it );
+}
+
+// ----------------------------------------------------------------------------
+size_t Mempool::eraseWithDescendants( Entries::iterator it )
+{
+   std::set<uint64_t> doomed = descendantsOf( it->second );
+   doomed.insert( it->first );
+
+   // Children first, nothing left behind spends from what is gone
+   for ( auto sequence = doomed.rbegin(); sequence != doomed.rend();
+         ++sequence )
+   {
+      erase( entries.find( *sequence ) );
+   }
+
+   return doomed.size();
+}
+
+// ----------------------------------------------------------------------------
+void Mempool::trim()
+{
+   // A parent paid for by its children scores with them and is kept
+   double evictedRate = -1.0;
+   while ( usage > maxBytes && !byDescendantScore.empty() )
+   {
+      const Priority lowest = *std::prev( byDescendantScore.end() );
+      evictedRate           = std::max( evictedRate, lowest.feeRate );
+      eraseWithDescendants( entries.find( lowest.sequence ) );
+   }
+
+   if ( evictedRate >= 0.0 )
+   {
+      // Whatever replaces the evicted transactions has to pay more than they
+      // did, otherwise a flood could cycle through the pool for free
+      rollingMinFeeRate =
+          std::max( minFeeRate(), evictedRate + INCREMENTAL_FEE_RATE );
+      lastMinFeeRaise = Clock::now();
+
+      std::cout << "Mempool full, minimum fee rate raised to "
+                << rollingMinFeeRate << std::endl;
+   }
+}
+
+// ----------------------------------------------------------------------------
+crypto::Digest Mempool::contentHash( const Transaction& tx )
+{
+   // Exactly what operator== compares, the amount bit for bit
+   serialize::ByteWriter writer;
+   writer.putString( tx.sender );
+   writer.putString( tx.receiver );
+   writer.putDouble( tx.amount );
+   writer.putI64( tx.timestamp.time_since_epoch().count() );
+
+   return crypto::sha256( writer.data().data(), writer.data().size() );
+}
+
+// ----------------------------------------------------------------------------
+size_t Mempool::entryUsage( const Transaction& tx, size_t parents )
+{
+   // Short strings live inside the object, longer ones own a heap block
+   auto heap = []( const std::string& s ) -> size_t
+   {
+      const char* data   = s.data();
+      const char* object = reinterpret_cast<const char*>( &s );
+      return data >= object && data < object + sizeof( s ) ? 0
+                                                           : s.capacity() + 1;
+   };
+
+   // libstdc++ layouts: a tree node has colour and three pointers, a hash node
+   // a next pointer and the cached hash plus its bucket slot
+   constexpr size_t TREE_NODE = 32;
+   constexpr size_t HASH_NODE = 24;
+
+   size_t bytes = TREE_NODE + sizeof( Entries::value_type );
+   bytes += heap( tx.txid ) + heap( tx.sender ) + heap( tx.receiver );
+
+   bytes += tx.inputs.capacity() * sizeof( Input );
+   for ( const auto& input : tx.inputs )
+   {
+      bytes += heap( input.txid ) + heap( input.signature );
+      // spentBy entry with its own copy of the txid
+      bytes += HASH_NODE + sizeof( decltype( spentBy )::value_type ) +
+               heap( input.txid );
+   }
+
+   bytes += tx.outputs.capacity() * sizeof( Output );
+   for ( const auto& output : tx.outputs )
+   {
+      bytes += heap( output.address );
+   }
+
+   bytes += HASH_NODE + sizeof( decltype( byTxid )::value_type ) +
+            heap( tx.txid );
+   bytes += 2 * ( TREE_NODE + sizeof( Priority ) );
+   bytes += HASH_NODE + sizeof( decltype( byContent )::value_type );
+   // A parent link is kept on both ends
+   bytes += parents * 2 * ( TREE_NODE + sizeof( uint64_t ) );
+   return bytes;
+}
+
+// ----------------------------------------------------------------------------
+double Mempool::fee( const Transaction& tx )
+{
+   // Admitted amounts are whole units, summing those is exact
+   int64_t fee = 0;
+   for ( const auto& input : tx.inputs )
+   {
+      fee += serialize::toUnits( input.amount );
+   }
+   for ( const auto& output : tx.outputs )
+   {
+      fee -= serialize::toUnits( output.amount );
+   }
+
+   return serialize::fromUnits( fee );
+}
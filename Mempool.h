@@ -0,0 +1,175 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Hash.h"
+#include "Transaction.h"
+#include "UTXO.h"
+
+// ----------------------------------------------------------------------------
+// Pending transactions, kept ordered by fee rate as they come and go. A block
+// template only walks the best ones instead of sorting the whole pool.
+//
+// The fee is what the inputs carry beyond the outputs, the rate is that fee
+// per byte of the canonical serialization. Equal rates keep arrival order.
+// Transactions are indexed by txid, by a hash of the fields operator==
+// compares and by the outpoints they spend, so duplicate and double-spend
+// checks do not depend on the size of the pool.
+//
+// A transaction may spend outputs of other pending ones. Every entry knows its
+// pending parents and children and keeps the totals of its ancestors and
+// descendants, templates are ordered by the fee rate of a transaction
+// together with its ancestors so a child can pay for its parent. Parents
+// always arrive before their children, arrival order is a valid block order.
+//
+// The memory of every transaction and its index entries is accounted for.
+// Once the pool is over its budget the lowest descendant fee rates are
+// evicted and the minimum fee rate rises above them, decaying again over
+// time. Transactions pending for longer than MAX_AGE expire, the node checks
+// on every admission and template. Whatever leaves the pool for another
+// reason than a block takes its descendants along.
+class Mempool
+{
+ public:
+   using Clock = std::chrono::steady_clock;
+
+   static constexpr size_t DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+   static constexpr auto   MAX_AGE           = std::chrono::hours( 24 );
+   // Package limits, both count the transaction itself
+   static constexpr size_t MAX_ANCESTORS   = 25;
+   static constexpr size_t MAX_DESCENDANTS = 25;
+
+   explicit Mempool( size_t maxBytes = DEFAULT_MAX_BYTES );
+
+   // Returns false for reward transactions, if a transaction with this txid
+   // is already pending, its fee rate is below minFeeRate(), it exceeds a
+   // package limit or it got evicted right away
+   bool add( const Transaction& tx );
+   // Removes txid and everything spending its outputs
+   bool remove( const std::string& txid );
+   // txid got into a block, its children stay as they now spend confirmed
+   // outputs
+   bool removeConfirmed( const std::string& txid );
+   void clear();
+   // Removes what is pending for longer than MAX_AGE, returns how many
+   size_t expire();
+
+   // Up to max transactions by the fee rate of their not yet selected
+   // ancestors and themselves, parents before children
+   std::vector<Transaction> select( size_t max ) const;
+
+   bool contains( const std::string& txid ) const;
+   // A pending transaction equal to tx by Transaction::operator==, or nullptr
+   const Transaction* findDuplicate( const Transaction& tx ) const;
+   // The pending transaction spending outpoint, or nullptr
+   const Transaction* spender( const utxo::Outpoint& outpoint ) const;
+   // Output of a pending transaction outpoint refers to, or nullptr
+   const Output* output( const utxo::Outpoint& outpoint ) const;
+
+   size_t size() const;
+   size_t memoryUsage() const;   // Bytes, including the indexes
+   void   setMaxBytes( size_t maxBytes );
+
+   // Rate a new transaction needs, 0 unless the pool had to evict recently
+   double minFeeRate() const;
+
+   static double fee( const Transaction& tx );
+
+ private:
+   struct Priority
+   {
+      double   feeRate;
+      uint64_t sequence;   // Arrival order, breaks ties
+
+      bool operator<( const Priority& other ) const
+      {
+         return feeRate != other.feeRate ? feeRate > other.feeRate
+                                         : sequence < other.sequence;
+      }
+   };
+
+   // Fee and size of a transaction with all its ancestors or descendants
+   struct Package
+   {
+      double fee   = 0.0;
+      size_t bytes = 0;
+      size_t count = 0;
+
+      double feeRate() const { return fee / static_cast<double>( bytes ); }
+   };
+
+   struct Entry
+   {
+      Transaction       tx;
+      uint64_t          sequence = 0;
+      Clock::time_point added;
+      size_t            usage = 0;
+      double            fee   = 0.0;
+      size_t            bytes = 0;   // Serialized size
+
+      // Sequences of the pending transactions this one spends from and the
+      // ones spending from it
+      std::set<uint64_t> parents;
+      std::set<uint64_t> children;
+
+      Package ancestors;     // Including this transaction
+      Package descendants;   // Including this transaction
+   };
+
+   // Keyed by sequence, the oldest entry comes first. Nodes never move.
+   using Entries = std::map<uint64_t, Entry>;
+
+   // Sequences of all pending ancestors or descendants of an entry
+   std::set<uint64_t> ancestorsOf( const Entry& entry ) const;
+   std::set<uint64_t> descendantsOf( const Entry& entry ) const;
+
+   // Update the totals of an entry and its position in the score index
+   void setAncestors( Entry& entry, const Package& package );
+   void setDescendants( Entry& entry, const Package& package );
+
+   // Removes a single entry, its ancestors and descendants stay
+   Entries::iterator erase( Entries::iterator it );
+   // Removes an entry and all its descendants, returns how many
+   size_t eraseWithDescendants( Entries::iterator it );
+   // Evicts the lowest descendant fee rates until the pool fits its budget
+   void trim();
+
+   // sha256 over sender, receiver, amount and timestamp
+   static crypto::Digest contentHash( const Transaction& tx );
+   // Heap and index memory a pending transaction takes
+   static size_t entryUsage( const Transaction& tx, size_t parents );
+
+   Entries                                            entries;
+   std::unordered_map<std::string, Entries::iterator> byTxid;
+   uint64_t                                           nextSequence = 0;
+
+   // Templates take the best ancestor scores, eviction the worst descendant
+   // scores
+   std::set<Priority> byAncestorScore;
+   std::set<Priority> byDescendantScore;
+
+   // Point into entries
+   std::unordered_map<crypto::Digest, const Transaction*, crypto::DigestHash>
+       byContent;
+   std::unordered_map<utxo::Outpoint, const Transaction*, utxo::OutpointHash>
+       spentBy;
+
+   size_t maxBytes;
+   size_t usage = 0;
+
+   // Raised to the rate of evicted transactions, halves every
+   // MIN_FEE_HALF_LIFE after the last raise
+   double            rollingMinFeeRate = 0.0;
+   Clock::time_point lastMinFeeRaise;
+
+   static constexpr auto MIN_FEE_HALF_LIFE = std::chrono::minutes( 30 );
+   // What an evicting transaction has to pay on top, 1 unit per byte
+   static constexpr double INCREMENTAL_FEE_RATE =
+       1.0 / serialize::UNITS_PER_COIN;
+};
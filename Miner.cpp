@@ -0,0 +1,116 @@
+#include <thread>
+#include <vector>
+
+#include "Miner.h"
+
+// ----------------------------------------------------------------------------
+Miner::Miner( uint32_t threads )
+{
+   setThreads( threads );
+}
+
+// ----------------------------------------------------------------------------
+void Miner::setThreads( uint32_t threads )
+{
+   if ( threads == 0 )
+   {
+      threads = std::thread::hardware_concurrency();
+   }
+
+   // hardware_concurrency is allowed to return 0
+   threadCount = threads > 0 ? threads : 1;
+}
+
+// ----------------------------------------------------------------------------
+uint32_t Miner::getThreads() const
+{
+   return threadCount;
+}
+
+// ----------------------------------------------------------------------------
+void Miner::cancel()
+{
+   ++cancelled;
+}
+
+// ----------------------------------------------------------------------------
+uint64_t Miner::generation() const
+{
+   return cancelled;
+}
+
+// ----------------------------------------------------------------------------
+bool Miner::mine( Block& block, uint64_t generation )
+{
+   stop  = false;
+   found = false;
+
+   const uint32_t           n = threadCount;
+   std::vector<std::thread> workers;
+   workers.reserve( n );
+   for ( uint32_t i = 0; i < n; ++i )
+   {
+      workers.emplace_back( [ this, &block, generation, i, n ]()
+                            { work( block, generation, i, n ); } );
+   }
+
+   for ( auto& worker : workers )
+   {
+      worker.join();
+   }
+
+   if ( !found )
+   {
+      return false;
+   }
+
+   block.nonce = foundNonce;
+   block.hash  = crypto::toHex( foundDigest );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+void Miner::work( const Block& block, uint64_t generation,
+                  uint64_t firstNonce, uint64_t stride )
+{
+   // The transactions do not change between attempts, only the header block
+   // holding the nonce is hashed, for as many nonces at once as the kernel
+   // has lanes
+   const BlockHasher           hasher( block );
+   const crypto::MiningKernel&  kernel = crypto::bestMiningKernel();
+   uint64_t                    nonces[ crypto::MINING_MAX_LANES ];
+   crypto::Digest              digests[ crypto::MINING_MAX_LANES ];
+
+   // A cancel() since the template was built makes it stale, even one that
+   // happened before the search started
+   for ( uint64_t base = firstNonce;
+         !stop.load( std::memory_order_relaxed ) &&
+         cancelled.load( std::memory_order_relaxed ) == generation;
+         base += stride * kernel.lanes )
+   {
+      for ( size_t lane = 0; lane < kernel.lanes; ++lane )
+      {
+         nonces[ lane ] = base + lane * stride;
+      }
+
+      kernel.hash( hasher.job(), nonces, digests );
+
+      for ( size_t lane = 0; lane < kernel.lanes; ++lane )
+      {
+         if ( !crypto::meetsDifficulty( digests[ lane ], block.difficulty ) )
+         {
+            continue;
+         }
+
+         // Only the first winner publishes its result
+         if ( !found.exchange( true ) )
+         {
+            foundNonce  = nonces[ lane ];
+            foundDigest = digests[ lane ];
+            stop        = true;
+         }
+
+         return;
+      }
+   }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "Block.h"
+
+// ----------------------------------------------------------------------------
+// Parallel proof of work search. The nonce space is split across the worker
+// threads, worker i tries the nonces i, i + n, i + 2n, ... The first worker
+// finding a valid hash stops all others.
+class Miner
+{
+ public:
+   // threads == 0 means one worker per hardware thread
+   explicit Miner( uint32_t threads = 0 );
+
+   // Searches a nonce satisfying block.difficulty and stores nonce and hash
+   // in the block. generation is what generation() returned before the
+   // template was built. Returns false if the search got cancelled, also by
+   // a cancel() before the search started.
+   bool mine( Block& block, uint64_t generation );
+
+   // Stops a running search and invalidates every template built before,
+   // used when a competing block got accepted
+   void cancel();
+   // Bumped by every cancel()
+   uint64_t generation() const;
+
+   void     setThreads( uint32_t threads );
+   uint32_t getThreads() const;
+
+ private:
+   void work( const Block& block, uint64_t generation, uint64_t firstNonce,
+              uint64_t stride );
+
+   std::atomic<uint32_t> threadCount;
+   std::atomic<uint64_t> cancelled{ 0 };
+   std::atomic<bool>     stop{ false };   // Set by the winning worker
+   std::atomic<bool>     found{ false };
+   uint64_t              foundNonce{};
+   crypto::Digest        foundDigest;
+};
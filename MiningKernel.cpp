@@ -0,0 +1,255 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#if defined( TZEH_X86_KERNELS )
+#include <cpuid.h>
+#endif
+
+#include "MiningKernel.h"
+#include "Sha256Lanes.h"
+
+namespace crypto
+{
+#if defined( TZEH_X86_KERNELS )
+// Defined in the MiningKernel<Isa>.cpp units, compiled with their own flags
+void hashSse41( const MiningJob& job, const uint64_t* nonces, Digest* digests );
+void hashAvx2( const MiningJob& job, const uint64_t* nonces, Digest* digests );
+void hashAvx512( const MiningJob& job, const uint64_t* nonces,
+                 Digest* digests );
+void hashShaNi( const MiningJob& job, const uint64_t* nonces, Digest* digests );
+#endif
+
+namespace
+{
+// ----------------------------------------------------------------------------
+struct ScalarOps
+{
+   using T                    = uint32_t;
+   static constexpr int LANES = 1;
+
+   static T set1( uint32_t x ) { return x; }
+   static T load( const uint32_t* p ) { return *p; }
+   static void store( uint32_t* p, T x ) { *p = x; }
+   static T add( T a, T b ) { return a + b; }
+   static T xor3( T a, T b, T c ) { return a ^ b ^ c; }
+   static T ch( T e, T f, T g ) { return ( e & f ) ^ ( ~e & g ); }
+   static T maj( T a, T b, T c ) { return ( a & b ) | ( c & ( a | b ) ); }
+
+   template <int N>
+   static T shr( T x )
+   {
+      return x >> N;
+   }
+
+   template <int N>
+   static T ror( T x )
+   {
+      return ( x >> N ) | ( x << ( 32 - N ) );
+   }
+};
+
+// ----------------------------------------------------------------------------
+void hashScalar( const MiningJob& job, const uint64_t* nonces, Digest* digests )
+{
+   Sha256Lanes<ScalarOps>::hash( job, nonces, digests );
+}
+
+// ----------------------------------------------------------------------------
+uint32_t readBigEndian( const unsigned char* p )
+{
+   return ( uint32_t( p[ 0 ] ) << 24 ) | ( uint32_t( p[ 1 ] ) << 16 ) |
+          ( uint32_t( p[ 2 ] ) << 8 ) | uint32_t( p[ 3 ] );
+}
+
+#if defined( TZEH_X86_KERNELS )
+// ----------------------------------------------------------------------------
+// __builtin_cpu_supports has no reliable flag for the sha extensions
+bool cpuHasShaNi()
+{
+   unsigned int eax, ebx, ecx, edx;
+   if ( !__get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) )
+   {
+      return false;
+   }
+
+   return ( ebx & ( 1u << 29 ) ) != 0 && __builtin_cpu_supports( "sse4.1" );
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Compares a kernel against OpenSSL over a header with varying nonces, a
+// nonce above 2^32 makes sure both nonce words get exercised
+bool verifyKernel( const MiningKernel& kernel )
+{
+   unsigned char header[ MINING_HEADER_SIZE ];
+   for ( size_t i = 0; i < sizeof( header ); ++i )
+   {
+      header[ i ] = static_cast<unsigned char>( i * 7 + 3 );
+   }
+
+   const MiningJob job = makeMiningJob( header );
+
+   uint64_t nonces[ MINING_MAX_LANES ];
+   Digest   digests[ MINING_MAX_LANES ];
+   for ( size_t lane = 0; lane < kernel.lanes; ++lane )
+   {
+      nonces[ lane ] = 0x1234567890ull + lane * 977;
+   }
+
+   kernel.hash( job, nonces, digests );
+
+   for ( size_t lane = 0; lane < kernel.lanes; ++lane )
+   {
+      for ( size_t i = 0; i < 8; ++i )
+      {
+         header[ MINING_NONCE_OFFSET + i ] =
+             static_cast<unsigned char>( nonces[ lane ] >> ( 56 - 8 * i ) );
+      }
+
+      if ( sha256( header, sizeof( header ) ) != digests[ lane ] )
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+// Hashes per second over a short window, which kernel wins depends on the
+// micro architecture (e.g. sha-ni vs avx512) so it is measured, not guessed
+double measureKernel( const MiningKernel& kernel )
+{
+   using Clock = std::chrono::steady_clock;
+
+   unsigned char header[ MINING_HEADER_SIZE ] = {};
+   const MiningJob job = makeMiningJob( header );
+
+   uint64_t nonces[ MINING_MAX_LANES ];
+   Digest   digests[ MINING_MAX_LANES ];
+   uint64_t hashes = 0;
+
+   const auto start = Clock::now();
+   auto       now   = start;
+   while ( now - start < std::chrono::milliseconds( 20 ) )
+   {
+      for ( int round = 0; round < 64; ++round )
+      {
+         for ( size_t lane = 0; lane < kernel.lanes; ++lane )
+         {
+            nonces[ lane ] = hashes + lane;
+         }
+
+         kernel.hash( job, nonces, digests );
+         hashes += kernel.lanes;
+      }
+
+      now = Clock::now();
+   }
+
+   return hashes / std::chrono::duration<double>( now - start ).count();
+}
+}   // namespace
+
+// ----------------------------------------------------------------------------
+void sha256Compress( uint32_t state[ 8 ], const uint32_t words[ 16 ] )
+{
+   Sha256Lanes<ScalarOps>::compress( state, words );
+}
+
+// ----------------------------------------------------------------------------
+MiningJob makeMiningJob( const unsigned char* header )
+{
+   MiningJob job;
+   std::memcpy( job.midstate, SHA256_IV, sizeof( job.midstate ) );
+
+   uint32_t words[ 16 ];
+   for ( int i = 0; i < 16; ++i )
+   {
+      words[ i ] = readBigEndian( header + 4 * i );
+   }
+   sha256Compress( job.midstate, words );
+
+   // The 24 byte header tail followed by the sha padding for 88 bytes
+   std::memset( job.block, 0, sizeof( job.block ) );
+   for ( int i = 0; i < 6; ++i )
+   {
+      job.block[ i ] = readBigEndian( header + 64 + 4 * i );
+   }
+   job.block[ 6 ]  = 0x80000000;
+   job.block[ 15 ] = MINING_HEADER_SIZE * 8;
+
+   return job;
+}
+
+// ----------------------------------------------------------------------------
+const MiningKernel& scalarMiningKernel()
+{
+   static const MiningKernel kernel{ "scalar", 1, hashScalar };
+   return kernel;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<MiningKernel> supportedMiningKernels()
+{
+   std::vector<MiningKernel> kernels;
+
+#if defined( TZEH_X86_KERNELS )
+   __builtin_cpu_init();
+
+   if ( __builtin_cpu_supports( "avx512f" ) )
+   {
+      kernels.push_back( { "avx512", 16, hashAvx512 } );
+   }
+   if ( cpuHasShaNi() )
+   {
+      kernels.push_back( { "sha-ni", 2, hashShaNi } );
+   }
+   if ( __builtin_cpu_supports( "avx2" ) )
+   {
+      kernels.push_back( { "avx2", 8, hashAvx2 } );
+   }
+   if ( __builtin_cpu_supports( "sse4.1" ) )
+   {
+      kernels.push_back( { "sse4.1", 4, hashSse41 } );
+   }
+#endif
+
+   kernels.push_back( scalarMiningKernel() );
+   return kernels;
+}
+
+// ----------------------------------------------------------------------------
+const MiningKernel& bestMiningKernel()
+{
+   static const MiningKernel best = []()
+   {
+      MiningKernel fastest      = scalarMiningKernel();
+      double       fastestSpeed = 0.0;
+      for ( const auto& kernel : supportedMiningKernels() )
+      {
+         if ( !verifyKernel( kernel ) )
+         {
+            std::cerr << "Mining kernel " << kernel.name
+                      << " failed self test, skipping it\n";
+            continue;
+         }
+
+         double speed = measureKernel( kernel );
+         if ( speed > fastestSpeed )
+         {
+            fastest      = kernel;
+            fastestSpeed = speed;
+         }
+      }
+
+      std::cout << "Using " << fastest.name << " mining kernel ("
+                << static_cast<uint64_t>( fastestSpeed / 1000 )
+                << " kH/s per thread)\n";
+      return fastest;
+   }();
+
+   return best;
+}
+};   // namespace crypto
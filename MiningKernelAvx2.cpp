@@ -0,0 +1,62 @@
+#include <immintrin.h>
+
+#include "Sha256Lanes.h"
+
+// Compiled with -mavx2, only called after runtime cpu detection
+
+namespace crypto
+{
+namespace
+{
+// ----------------------------------------------------------------------------
+struct Avx2Ops
+{
+   using T                    = __m256i;
+   static constexpr int LANES = 8;
+
+   static T set1( uint32_t x ) { return _mm256_set1_epi32( int( x ) ); }
+   static T load( const uint32_t* p )
+   {
+      return _mm256_load_si256( reinterpret_cast<const __m256i*>( p ) );
+   }
+   static void store( uint32_t* p, T x )
+   {
+      _mm256_store_si256( reinterpret_cast<__m256i*>( p ), x );
+   }
+   static T add( T a, T b ) { return _mm256_add_epi32( a, b ); }
+   static T xor3( T a, T b, T c )
+   {
+      return _mm256_xor_si256( _mm256_xor_si256( a, b ), c );
+   }
+   static T ch( T e, T f, T g )
+   {
+      return _mm256_xor_si256( _mm256_and_si256( e, f ),
+                               _mm256_andnot_si256( e, g ) );
+   }
+   static T maj( T a, T b, T c )
+   {
+      return _mm256_or_si256( _mm256_and_si256( a, b ),
+                              _mm256_and_si256( c, _mm256_or_si256( a, b ) ) );
+   }
+
+   template <int N>
+   static T shr( T x )
+   {
+      return _mm256_srli_epi32( x, N );
+   }
+
+   template <int N>
+   static T ror( T x )
+   {
+      return _mm256_or_si256( _mm256_srli_epi32( x, N ),
+                              _mm256_slli_epi32( x, 32 - N ) );
+   }
+};
+}   // namespace
+
+// ----------------------------------------------------------------------------
+void hashAvx2( const MiningJob& job, const uint64_t* nonces, Digest* digests )
+{
+   Sha256Lanes<Avx2Ops>::hash( job, nonces, digests );
+}
+};   // namespace crypto
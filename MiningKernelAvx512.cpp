@@ -0,0 +1,57 @@
+#include <immintrin.h>
+
+#include "Sha256Lanes.h"
+
+// Compiled with -mavx512f, only called after runtime cpu detection
+
+namespace crypto
+{
+namespace
+{
+// ----------------------------------------------------------------------------
+struct Avx512Ops
+{
+   using T                    = __m512i;
+   static constexpr int LANES = 16;
+
+   static T set1( uint32_t x ) { return _mm512_set1_epi32( int( x ) ); }
+   static T load( const uint32_t* p ) { return _mm512_load_si512( p ); }
+   static void store( uint32_t* p, T x ) { _mm512_store_si512( p, x ); }
+   static T add( T a, T b ) { return _mm512_add_epi32( a, b ); }
+
+   // Boolean functions of three inputs are a single vpternlogd, the immediate
+   // is the truth table
+   static T xor3( T a, T b, T c )
+   {
+      return _mm512_ternarylogic_epi32( a, b, c, 0x96 );
+   }
+   static T ch( T e, T f, T g )
+   {
+      return _mm512_ternarylogic_epi32( e, f, g, 0xca );
+   }
+   static T maj( T a, T b, T c )
+   {
+      return _mm512_ternarylogic_epi32( a, b, c, 0xe8 );
+   }
+
+   template <int N>
+   static T shr( T x )
+   {
+      return _mm512_srli_epi32( x, N );
+   }
+
+   template <int N>
+   static T ror( T x )
+   {
+      return _mm512_ror_epi32( x, N );
+   }
+};
+}   // namespace
+
+// ----------------------------------------------------------------------------
+void hashAvx512( const MiningJob& job, const uint64_t* nonces,
+                 Digest* digests )
+{
+   Sha256Lanes<Avx512Ops>::hash( job, nonces, digests );
+}
+};   // namespace crypto
@@ -0,0 +1,99 @@
+#include <cstring>
+#include <immintrin.h>
+
+#include "MiningKernel.h"
+
+// Compiled with -msse4.1 -msha, only called after runtime cpu detection. The
+// sha extensions work on a single message, two nonces are interleaved per
+// call to hide the latency of sha256rnds2.
+
+namespace crypto
+{
+namespace
+{
+constexpr int LANES = 2;
+}   // namespace
+
+// ----------------------------------------------------------------------------
+void hashShaNi( const MiningJob& job, const uint64_t* nonces, Digest* digests )
+{
+   // sha256rnds2 expects the state split into ABEF and CDGH
+   __m128i tmp = _mm_loadu_si128(
+       reinterpret_cast<const __m128i*>( &job.midstate[ 0 ] ) );
+   __m128i efgh = _mm_loadu_si128(
+       reinterpret_cast<const __m128i*>( &job.midstate[ 4 ] ) );
+   tmp                = _mm_shuffle_epi32( tmp, 0xb1 );    // CDAB
+   efgh               = _mm_shuffle_epi32( efgh, 0x1b );   // EFGH
+   const __m128i abef = _mm_alignr_epi8( tmp, efgh, 8 );
+   const __m128i cdgh = _mm_blend_epi16( efgh, tmp, 0xf0 );
+
+   __m128i state0[ LANES ];
+   __m128i state1[ LANES ];
+   __m128i msg[ LANES ][ 4 ];
+   for ( int lane = 0; lane < LANES; ++lane )
+   {
+      uint32_t words[ 16 ];
+      std::memcpy( words, job.block, sizeof( words ) );
+      words[ 4 ] = static_cast<uint32_t>( nonces[ lane ] >> 32 );
+      words[ 5 ] = static_cast<uint32_t>( nonces[ lane ] );
+
+      for ( int i = 0; i < 4; ++i )
+      {
+         msg[ lane ][ i ] =
+             _mm_loadu_si128( reinterpret_cast<const __m128i*>( words + 4 * i ) );
+      }
+
+      state0[ lane ] = abef;
+      state1[ lane ] = cdgh;
+   }
+
+   // 16 groups of 4 rounds, the message schedule lives in a rolling window
+   // of 4 groups
+   for ( int i = 0; i < 16; ++i )
+   {
+      const __m128i k = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>( &SHA256_K[ 4 * i ] ) );
+
+      for ( int lane = 0; lane < LANES; ++lane )
+      {
+         __m128i* m = msg[ lane ];
+         if ( i >= 4 )
+         {
+            m[ i & 3 ] = _mm_sha256msg2_epu32(
+                _mm_add_epi32(
+                    _mm_sha256msg1_epu32( m[ i & 3 ], m[ ( i + 1 ) & 3 ] ),
+                    _mm_alignr_epi8( m[ ( i + 3 ) & 3 ], m[ ( i + 2 ) & 3 ],
+                                     4 ) ),
+                m[ ( i + 3 ) & 3 ] );
+         }
+
+         __m128i wk     = _mm_add_epi32( m[ i & 3 ], k );
+         state1[ lane ] = _mm_sha256rnds2_epu32( state1[ lane ], state0[ lane ],
+                                                 wk );
+         wk             = _mm_shuffle_epi32( wk, 0x0e );
+         state0[ lane ] = _mm_sha256rnds2_epu32( state0[ lane ], state1[ lane ],
+                                                 wk );
+      }
+   }
+
+   // Back to ABCD EFGH, byte swapped straight into the big endian digest
+   const __m128i byteSwap =
+       _mm_set_epi8( 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3 );
+   for ( int lane = 0; lane < LANES; ++lane )
+   {
+      __m128i s0 = _mm_add_epi32( state0[ lane ], abef );
+      __m128i s1 = _mm_add_epi32( state1[ lane ], cdgh );
+
+      tmp = _mm_shuffle_epi32( s0, 0x1b );         // FEBA
+      s1  = _mm_shuffle_epi32( s1, 0xb1 );         // DCHG
+      s0  = _mm_blend_epi16( tmp, s1, 0xf0 );      // DCBA
+      s1  = _mm_alignr_epi8( s1, tmp, 8 );         // HGFE
+
+      _mm_storeu_si128( reinterpret_cast<__m128i*>( digests[ lane ].data() ),
+                        _mm_shuffle_epi8( s0, byteSwap ) );
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>( digests[ lane ].data() + 16 ),
+          _mm_shuffle_epi8( s1, byteSwap ) );
+   }
+}
+};   // namespace crypto
@@ -0,0 +1,60 @@
+#include <immintrin.h>
+
+#include "Sha256Lanes.h"
+
+// Compiled with -msse4.1, only called after runtime cpu detection
+
+namespace crypto
+{
+namespace
+{
+// ----------------------------------------------------------------------------
+struct Sse41Ops
+{
+   using T                    = __m128i;
+   static constexpr int LANES = 4;
+
+   static T set1( uint32_t x ) { return _mm_set1_epi32( int( x ) ); }
+   static T load( const uint32_t* p )
+   {
+      return _mm_load_si128( reinterpret_cast<const __m128i*>( p ) );
+   }
+   static void store( uint32_t* p, T x )
+   {
+      _mm_store_si128( reinterpret_cast<__m128i*>( p ), x );
+   }
+   static T add( T a, T b ) { return _mm_add_epi32( a, b ); }
+   static T xor3( T a, T b, T c )
+   {
+      return _mm_xor_si128( _mm_xor_si128( a, b ), c );
+   }
+   static T ch( T e, T f, T g )
+   {
+      return _mm_xor_si128( _mm_and_si128( e, f ), _mm_andnot_si128( e, g ) );
+   }
+   static T maj( T a, T b, T c )
+   {
+      return _mm_or_si128( _mm_and_si128( a, b ),
+                           _mm_and_si128( c, _mm_or_si128( a, b ) ) );
+   }
+
+   template <int N>
+   static T shr( T x )
+   {
+      return _mm_srli_epi32( x, N );
+   }
+
+   template <int N>
+   static T ror( T x )
+   {
+      return _mm_or_si128( _mm_srli_epi32( x, N ), _mm_slli_epi32( x, 32 - N ) );
+   }
+};
+}   // namespace
+
+// ----------------------------------------------------------------------------
+void hashSse41( const MiningJob& job, const uint64_t* nonces, Digest* digests )
+{
+   Sha256Lanes<Sse41Ops>::hash( job, nonces, digests );
+}
+};   // namespace crypto
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "MiningKernel.h"
+
+// ----------------------------------------------------------------------------
+// Compares every mining kernel the cpu supports against the scalar one over
+// random headers and nonce ranges. The ranges are walked in batches of the
+// kernel's width like Miner does, with strides, ranges crossing 2^32 (the
+// carry into the high nonce word) and lengths leaving a partial final batch.
+// The scalar kernel itself is checked against OpenSSL first.
+namespace
+{
+using crypto::Digest;
+using crypto::MINING_HEADER_SIZE;
+using crypto::MINING_MAX_LANES;
+using crypto::MINING_NONCE_OFFSET;
+using crypto::MiningKernel;
+
+constexpr int HEADERS = 200;
+
+struct Range
+{
+   uint64_t first;
+   uint64_t count;
+   uint64_t stride;
+};
+
+// ----------------------------------------------------------------------------
+Digest referenceDigest( unsigned char* header, uint64_t nonce )
+{
+   for ( size_t i = 0; i < 8; ++i )
+   {
+      header[ MINING_NONCE_OFFSET + i ] =
+          static_cast<unsigned char>( nonce >> ( 56 - 8 * i ) );
+   }
+
+   return crypto::sha256( header, MINING_HEADER_SIZE );
+}
+
+// ----------------------------------------------------------------------------
+// Returns the number of mismatching nonces
+size_t checkRange( const MiningKernel& kernel, const crypto::MiningJob& job,
+                   const Range& range )
+{
+   const MiningKernel& scalar = crypto::scalarMiningKernel();
+
+   uint64_t nonces[ MINING_MAX_LANES ];
+   Digest   digests[ MINING_MAX_LANES ];
+   size_t   mismatches = 0;
+
+   for ( uint64_t done = 0; done < range.count; done += kernel.lanes )
+   {
+      // Lanes past the end of the range hash nonce zero and are not compared
+      const uint64_t used = std::min<uint64_t>( kernel.lanes,
+                                                range.count - done );
+      for ( size_t lane = 0; lane < kernel.lanes; ++lane )
+      {
+         nonces[ lane ] =
+             lane < used ? range.first + ( done + lane ) * range.stride : 0;
+      }
+
+      kernel.hash( job, nonces, digests );
+
+      for ( size_t lane = 0; lane < used; ++lane )
+      {
+         Digest expected;
+         scalar.hash( job, &nonces[ lane ], &expected );
+         if ( expected != digests[ lane ] )
+         {
+            std::cerr << kernel.name << ": mismatch for nonce "
+                      << nonces[ lane ] << " in lane " << lane << "\n";
+            ++mismatches;
+         }
+      }
+   }
+
+   return mismatches;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<Range> rangesFor( std::mt19937_64& rng )
+{
+   constexpr uint64_t HIGH_WORD = 1ull << 32;
+
+   std::uniform_int_distribution<uint64_t> any;
+   std::uniform_int_distribution<uint64_t> length( 1, 3 * MINING_MAX_LANES );
+   std::uniform_int_distribution<uint64_t> stride( 1, 64 );
+
+   std::vector<Range> ranges;
+   ranges.push_back( { 0, length( rng ), 1 } );
+   ranges.push_back( { any( rng ), length( rng ), stride( rng ) } );
+   // Crossing 2^32 with a step of one and with a miner like stride
+   ranges.push_back( { HIGH_WORD - 5, length( rng ) + 5, 1 } );
+   ranges.push_back( { HIGH_WORD - 3 * 24, 7 + length( rng ), 24 } );
+   // A carry into a larger high word and the top of the nonce space
+   ranges.push_back( { 7 * HIGH_WORD - 2, length( rng ) + 2, 1 } );
+   ranges.push_back( { ~0ull - MINING_MAX_LANES, MINING_MAX_LANES + 1, 1 } );
+   return ranges;
+}
+
+// ----------------------------------------------------------------------------
+bool scalarMatchesOpenSsl( std::mt19937_64& rng )
+{
+   const MiningKernel& scalar = crypto::scalarMiningKernel();
+
+   unsigned char header[ MINING_HEADER_SIZE ];
+   for ( int round = 0; round < HEADERS; ++round )
+   {
+      for ( auto& byte : header )
+      {
+         byte = static_cast<unsigned char>( rng() );
+      }
+
+      const auto job = crypto::makeMiningJob( header );
+      for ( const auto& range : rangesFor( rng ) )
+      {
+         uint64_t nonce = range.first;
+         Digest   digest;
+         scalar.hash( job, &nonce, &digest );
+         if ( digest != referenceDigest( header, nonce ) )
+         {
+            std::cerr << "scalar: differs from OpenSSL for nonce " << nonce
+                      << "\n";
+            return false;
+         }
+      }
+   }
+
+   return true;
+}
+}   // namespace
+
+// ----------------------------------------------------------------------------
+int main()
+{
+   std::mt19937_64 rng( 20240601 );
+
+   if ( !scalarMatchesOpenSsl( rng ) )
+   {
+      return 1;
+   }
+
+   size_t failures = 0;
+   for ( const auto& kernel : crypto::supportedMiningKernels() )
+   {
+      size_t        mismatches = 0;
+      unsigned char header[ MINING_HEADER_SIZE ];
+      for ( int round = 0; round < HEADERS; ++round )
+      {
+         for ( auto& byte : header )
+         {
+            byte = static_cast<unsigned char>( rng() );
+         }
+
+         const auto job = crypto::makeMiningJob( header );
+         for ( const auto& range : rangesFor( rng ) )
+         {
+            mismatches += checkRange( kernel, job, range );
+         }
+      }
+
+      std::cout << kernel.name << " (" << kernel.lanes
+                << " lanes): " << ( mismatches == 0 ? "ok" : "FAILED" )
+                << "\n";
+      failures += mismatches;
+   }
+
+   return failures == 0 ? 0 : 1;
+}
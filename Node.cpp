@@ -1,3 +1,11 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+#include "JsonReader.h"
 #include "Node.h"
 
 // ----------------------------------------------------------------------------
@@ -5,66 +13,162 @@ void Node::broadcastBlock( const Block& block ) const
 {
    std::cout << "Broadcasting Block\n";
 
-   for ( const auto& peer : peers )
+   markKnown( block.hash );
+
+   serialize::ByteWriter writer;
+   block.encodeCompact( writer );
+   broadcaster.announce( Broadcaster::Kind::Block, block.hash,
+                         writer.release() );
+}
+
+// ----------------------------------------------------------------------------
+void Node::broadcastTransaction( const Transaction& tx ) const
+{
+   std::cout << "Broadcasting tx\n";
+
+   markKnown( tx.txid );
+
+   serialize::ByteWriter writer;
+   tx.encodeCompact( writer );
+   broadcaster.announce( Broadcaster::Kind::Transaction, tx.txid,
+                         writer.release() );
+}
+
+// ----------------------------------------------------------------------------
+bool Node::markKnown( const std::string& id ) const
+{
    {
-      try
+      std::lock_guard<std::mutex> lock( inventoryMutex );
+      requested.erase( id );
+   }
+
+   return seen.insert( id );
+}
+
+// ----------------------------------------------------------------------------
+void Node::markRejected( const std::string& id, const std::string& body ) const
+{
+   const auto now = Clock::now();
+
+   std::lock_guard<std::mutex> lock( inventoryMutex );
+   if ( !id.empty() )
+   {
+      requested.erase( id );
+   }
+
+   if ( rejected.size() >= MAX_REJECTED )
+   {
+      for ( auto it = rejected.begin(); it != rejected.end(); )
       {
-         httplib::Client cli( peer.c_str() );
-         json            blockJson = block;
-         cli.Post( "/block", blockJson.dump(), "application/json" );
+         it = now - it->second > REJECT_TIMEOUT ? rejected.erase( it )
+                                                : std::next( it );
       }
-      catch ( const std::exception& e )
+
+      // Still full, a flood of distinct garbage. Forgetting them only costs
+      // parsing them again.
+      if ( rejected.size() >= MAX_REJECTED )
       {
-         std::cout << "Something went wrong with a peer maybe offline Peer: "
-                   << peer << std::endl;
+         rejected.clear();
       }
    }
+
+   rejected[ crypto::sha256( body.data(), body.size() ) ] = now;
 }
 
 // ----------------------------------------------------------------------------
-void Node::broadcastTransaction( const Transaction& tx ) const
+bool Node::isRejected( const std::string& body ) const
 {
-   std::cout << "Broadcasting tx\n";
+   const auto digest = crypto::sha256( body.data(), body.size() );
 
-   for ( const auto& peer : peers )
+   std::lock_guard<std::mutex> lock( inventoryMutex );
+   auto it = rejected.find( digest );
+   if ( it == rejected.end() )
    {
-      httplib::Client cli( peer.c_str() );
+      return false;
+   }
 
-      json j = tx;
-      cli.Post( "/tx", j.dump(), "application/json" );
+   if ( Clock::now() - it->second > REJECT_TIMEOUT )
+   {
+      rejected.erase( it );
+      return false;
    }
+
+   return true;
 }
 
 // ----------------------------------------------------------------------------
-std::pair<int32_t, std::string> Node::getLongestChainHeight() const
+bool Node::isSeen( const httplib::Request& req ) const
 {
-   std::cout << "Retrieveng highest chain hight from peers" << std::endl;
+   const auto id = req.get_header_value( "X-Inventory-Id" );
+   return !id.empty() && seen.contains( id );
+}
 
-   int32_t                         highestHeight{};
-   std::pair<int32_t, std::string> peerWithHighestChain{ -420, "" };
+// ----------------------------------------------------------------------------
+bool Node::isSeen( const httplib::Request& req, const std::string& id ) const
+{
+   if ( !req.get_header_value( "X-Inventory-Id" ).empty() )
+   {
+      return seen.peek( id );
+   }
+
+   return seen.contains( id );
+}
+
+// ----------------------------------------------------------------------------
+json Node::wantedInventory( const json& inventory ) const
+{
+   json wanted = { { "tx", json::array() }, { "block", json::array() } };
+
+   std::lock_guard<std::mutex> lock( inventoryMutex );
+
+   // Requests a peer never answered must not block fetching from another one
+   const auto now = Clock::now();
+   for ( auto it = requested.begin(); it != requested.end(); )
+   {
+      it = now - it->second > REQUEST_TIMEOUT ? requested.erase( it )
+                                                : std::next( it );
+   }
+
+   for ( const char* kind : { "tx", "block" } )
+   {
+      for ( const auto& item : inventory.value( kind, json::array() ) )
+      {
+         auto id = item.get<std::string>();
+         // Inventory queries stay out of the dedup counters of /inv/stats
+         if ( requested.count( id ) || seen.peek( id ) )
+         {
+            continue;
+         }
+
+         // Blocks from before the node started are only in the store
+         if ( kind == std::string( "block" ) && bc.getBlockHeight( id ) >= 0 )
+         {
+            continue;
+         }
+
+         requested.emplace( id, now );
+         wanted[ kind ].push_back( std::move( id ) );
+      }
+   }
+
+   return wanted;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<std::pair<std::string, int32_t>> Node::getPeerHeights() const
+{
+   std::vector<std::pair<std::string, int32_t>> heights;
    for ( const auto& peer : peers )
    {
+      int32_t height = -1;
       try
       {
-         httplib::Client cli( peer.c_str() );
-         auto            res = cli.Get( "/chain/height" );
+         auto res = pool.get( peer, "/chain/height" );
 
          if ( res && res->status == 200 )
          {
-            nlohmann::json j      = json::parse( res->body );
-            int32_t        height = j[ "height" ].template get<int>();
-
-            if ( height <= bc.chain.size() - 1 )
-            {
-               continue;
-            }
-
-            if ( height > highestHeight )
-            {
-               highestHeight               = height;
-               peerWithHighestChain.first  = highestHeight;
-               peerWithHighestChain.second = peer;
-            }
+            nlohmann::json j = json::parse( res->body );
+            height           = j[ "height" ].template get<int>();
          }
       }
       catch ( const std::exception& e )
@@ -72,6 +176,33 @@ std::pair<int32_t, std::string> Node::getLongestChainHeight() const
          std::cout << "Something went wrong with a peer maybe offline Peer: "
                    << peer << std::endl;
       }
+
+      heights.emplace_back( peer, height );
+   }
+
+   return heights;
+}
+
+// ----------------------------------------------------------------------------
+std::pair<int32_t, std::string> Node::getLongestChainHeight() const
+{
+   std::cout << "Retrieveng highest chain hight from peers" << std::endl;
+
+   // Signed, an empty chain has height -1
+   int32_t ownHeight;
+   {
+      std::shared_lock<std::shared_mutex> lock( bc.chainMutex );
+      ownHeight = static_cast<int32_t>( bc.chain.size() ) - 1;
+   }
+
+   std::pair<int32_t, std::string> peerWithHighestChain{ -420, "" };
+   for ( const auto& [ peer, height ] : getPeerHeights() )
+   {
+      if ( height > ownHeight && height > peerWithHighestChain.first )
+      {
+         peerWithHighestChain.first  = height;
+         peerWithHighestChain.second = peer;
+      }
    }
 
    return peerWithHighestChain;
@@ -82,32 +213,216 @@ std::vector<Block> Node::syncChain() const
 {
    std::cout << "Checking if chain needs some syncing" << std::endl;
 
-   // pair.first is only positiv if a higher chain is found
-   std::pair<int32_t, std::string> peerWithHighestChain =
-       getLongestChainHeight();
+   auto peerHeights = getPeerHeights();
 
-   std::vector<Block> newChain;
-   if ( peerWithHighestChain.first <= 0 )
+   std::string bestPeer;
+   int32_t     bestHeight = 0;
+   for ( const auto& [ peer, height ] : peerHeights )
+   {
+      if ( height > bestHeight )
+      {
+         bestHeight = height;
+         bestPeer   = peer;
+      }
+   }
+
+   if ( bestPeer.empty() )
    {
       std::cout << "No sync needed, no longer chain was found\n";
-      return newChain;
+      return {};
    }
 
-   // Now we can load the whole chain and start updating utxos
-   std::string peer = peerWithHighestChain.second;
-   try
+   // Headers first, they are small and tell which bodies to expect
+   auto hashes = fetchHeaders( bestPeer, bestHeight );
+   if ( hashes.size() < 2 )
+   {
+      return {};
+   }
+
+   // Blocks we already store are not downloaded again, a sync interrupted by
+   // a restart continues where the stored chain ends
+   std::vector<Block> newChain( hashes.size() );
+   size_t             reused = 0;
+   while ( reused < hashes.size() && bc.getBlock( reused, newChain[ reused ] ) &&
+           crypto::hexEquals( newChain[ reused ].hash, hashes[ reused ] ) )
+   {
+      ++reused;
+   }
+
+   if ( reused < hashes.size() )
+   {
+      newChain[ reused ] = Block();
+   }
+
+   std::deque<std::pair<size_t, size_t>> batches;
+   for ( size_t from = reused; from < hashes.size();
+         from += MAX_BLOCKS_PER_REQUEST )
    {
+      batches.emplace_back(
+          from, std::min( MAX_BLOCKS_PER_REQUEST, hashes.size() - from ) );
+   }
+
+   std::cout << "Synced " << hashes.size() << " headers from " << bestPeer
+             << ", downloading " << hashes.size() - reused << " blocks\n";
+
+   // One worker per peer pulls batches until none are left and none is in
+   // flight. A batch beyond the height of a peer goes back to the queue for
+   // the others and the peer drops out. A failed download aborts the sync,
+   // the other workers stop after their current batch.
+   std::mutex               batchesMutex;
+   std::condition_variable  batchesChanged;
+   size_t                   inFlight = 0;
+   bool                     failed   = false;
+   std::vector<std::thread> workers;
+   for ( const auto& [ peer, height ] : peerHeights )
+   {
+      // A peer that failed since reporting its height is backed off, its
+      // worker would only take a batch and hand it back
+      if ( height <= 0 || !pool.isHealthy( peer ) )
+      {
+         continue;
+      }
+
+      workers.emplace_back(
+          [ &, peer = peer, height = height ]()
+          {
+             while ( true )
+             {
+                std::pair<size_t, size_t> batch;
+                {
+                   std::unique_lock<std::mutex> lock( batchesMutex );
+                   batchesChanged.wait( lock,
+                                        [ & ]()
+                                        {
+                                           return failed || !batches.empty() ||
+                                                  inFlight == 0;
+                                        } );
+                   if ( failed || batches.empty() )
+                   {
+                      return;
+                   }
+
+                   batch = batches.front();
+                   batches.pop_front();
+                   ++inFlight;
+                }
+
+                const bool reachable =
+                    batch.first + batch.second - 1 <=
+                    static_cast<size_t>( height );
+                const bool fetched =
+                    reachable && fetchBlocks( peer, batch.first, batch.second,
+                                              hashes, newChain );
+
+                std::lock_guard<std::mutex> lock( batchesMutex );
+                --inFlight;
+                if ( !fetched )
+                {
+                   batches.push_back( batch );
+                   failed = failed || reachable;
+                }
+                batchesChanged.notify_all();
+
+                if ( !fetched )
+                {
+                   if ( reachable )
+                   {
+                      std::cout << "Downloading blocks " << batch.first
+                                << " to " << batch.first + batch.second - 1
+                                << " from " << peer << " failed\n";
+                   }
+                   return;
+                }
+             }
+          } );
+   }
+
+   for ( auto& worker : workers )
+   {
+      worker.join();
+   }
+
+   // A batch no peer could deliver fails the sync, a chain cut short at the
+   // gap is not what the headers promised
+   if ( failed || !batches.empty() )
+   {
+      std::cout << "Sync failed, " << batches.size()
+                << " block batches could not be downloaded\n";
+      return {};
+   }
 
-      httplib::Client cli( peer );
-      auto            res = cli.Get( "/chain" );
+   return newChain;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<crypto::Digest> Node::fetchHeaders( const std::string& peer,
+                                                int32_t height ) const
+{
+   std::vector<crypto::Digest> hashes;
+   // Timestamps of the headers so far, a retarget looks ten blocks back
+   std::vector<int64_t> timestamps;
+   int32_t              previousDifficulty = 0;
 
-      if ( res && res->status == 200 )
+   try
+   {
+      while ( hashes.size() <= static_cast<size_t>( height ) )
       {
-         nlohmann::json j = json::parse( res->body );
+         const std::string path =
+             "/headers?from=" + std::to_string( hashes.size() ) +
+             "&count=" + std::to_string( MAX_HEADERS_PER_REQUEST );
+
+         auto res = pool.get( peer, path );
+         if ( !res || res->status != 200 || res->body.empty() ||
+              res->body.size() % Block::HEADER_SIZE != 0 )
+         {
+            std::cout << "Header download from " << peer << " stopped at "
+                      << hashes.size() << std::endl;
+            break;
+         }
 
-         for ( const auto& blockJson : j )
+         for ( size_t offset = 0; offset < res->body.size();
+               offset += Block::HEADER_SIZE )
          {
-            newChain.emplace_back( Block( blockJson ) );
+            const char* header = res->body.data() + offset;
+            auto        digest = crypto::sha256( header, Block::HEADER_SIZE );
+
+            // index(4) prevHash(32) merkleRoot(32) timestamp(8) difficulty(4)
+            serialize::ByteReader reader(
+                std::string_view( header, Block::HEADER_SIZE ) );
+            int32_t        index = reader.getI32();
+            crypto::Digest prev;
+            reader.getBytes( prev.data(), prev.size() );
+            crypto::Digest root;
+            reader.getBytes( root.data(), root.size() );
+            int64_t timestamp  = reader.getI64();
+            int32_t difficulty = reader.getI32();
+
+            // A header may not pick its own difficulty, it has to be the one
+            // addBlock expects at this height
+            int32_t expected = previousDifficulty;
+            if ( Blockchain::isRetargetHeight( hashes.size() ) )
+            {
+               expected = Blockchain::retargetDifficulty(
+                   previousDifficulty,
+                   timestamps.back() - timestamps[ timestamps.size() - 10 ] );
+            }
+
+            // The genesis block is not mined and has no predecessor
+            const bool valid =
+                index == static_cast<int32_t>( hashes.size() ) &&
+                ( index == 0 ||
+                  ( prev == hashes.back() && difficulty == expected &&
+                    crypto::meetsDifficulty( digest, difficulty ) ) );
+            if ( !valid )
+            {
+               std::cout << "Invalid header " << index << " from " << peer
+                         << std::endl;
+               return hashes;
+            }
+
+            hashes.push_back( digest );
+            timestamps.push_back( timestamp );
+            previousDifficulty = difficulty;
          }
       }
    }
@@ -117,5 +432,244 @@ std::vector<Block> Node::syncChain() const
                 << peer << std::endl;
    }
 
-   return newChain;
+   return hashes;
+}
+
+// ----------------------------------------------------------------------------
+bool Node::fetchBlocks( const std::string& peer, size_t from, size_t count,
+                        const std::vector<crypto::Digest>& hashes,
+                        std::vector<Block>&                blocks ) const
+{
+   // Bytes of a block not received completely yet
+   std::string pending;
+   size_t      height = from;
+
+   auto receive = [ & ]( const char* data, size_t length )
+   {
+      // Blocks lying completely within the received buffer are decoded right
+      // from it, only a block split across buffers gets copied into pending
+      std::string_view input( data, length );
+      if ( !pending.empty() )
+      {
+         pending.append( data, length );
+         input = pending;
+      }
+
+      size_t consumed = 0;
+      while ( input.size() - consumed >= 4 )
+      {
+         auto rest = input.substr( consumed );
+
+         serialize::ByteReader prefix( rest );
+         uint32_t              size = prefix.getU32();
+         if ( size > MAX_BLOCK_SIZE || height >= from + count )
+         {
+            return false;
+         }
+
+         if ( prefix.remaining() < size )
+         {
+            break;
+         }
+
+         try
+         {
+            serialize::ByteReader reader( rest.substr( 4, size ) );
+            Block                 block = Block::decodeCompact( reader );
+
+            // The body has to be the one the header chain committed to, the
+            // merkle root is checked by the chain validation afterwards
+            if ( block.index != static_cast<int32_t>( height ) ||
+                 block.calculateDigest() != hashes[ height ] ||
+                 !crypto::hexEquals( block.hash, hashes[ height ] ) )
+            {
+               return false;
+            }
+
+            blocks[ height++ ] = std::move( block );
+         }
+         catch ( const std::exception& e )
+         {
+            std::cout << "Invalid blocks from peer: " << e.what() << std::endl;
+            return false;
+         }
+
+         consumed += 4 + size;
+      }
+
+      if ( pending.empty() )
+      {
+         pending.assign( input.substr( consumed ) );
+      }
+      else
+      {
+         pending.erase( 0, consumed );
+      }
+
+      return true;
+   };
+
+   const std::string path = "/blocks?from=" + std::to_string( from ) +
+                            "&count=" + std::to_string( count );
+
+   const httplib::Headers headers{ { "Accept",
+                                     serialize::COMPACT_CONTENT_TYPE } };
+
+   auto res = pool.request( peer, [ & ]( httplib::Client& cli )
+                            { return cli.Get( path, headers, receive ); } );
+
+   return res && res->status == 200 && height == from + count &&
+          pending.empty();
+}
+
+// ----------------------------------------------------------------------------
+Transaction Node::parseTransaction( const httplib::Request& req )
+{
+   if ( req.get_header_value( "Content-Type" ) !=
+        serialize::COMPACT_CONTENT_TYPE )
+   {
+      return jsonreader::parseTransaction( req.body );
+   }
+
+   serialize::ByteReader reader( req.body );
+   Transaction           tx = Transaction::decodeCompact( reader );
+   if ( reader.remaining() != 0 )
+   {
+      throw std::invalid_argument( "Trailing bytes after transaction" );
+   }
+
+   return tx;
+}
+
+// ----------------------------------------------------------------------------
+Block Node::parseBlock( const httplib::Request& req )
+{
+   if ( req.get_header_value( "Content-Type" ) !=
+        serialize::COMPACT_CONTENT_TYPE )
+   {
+      return jsonreader::parseBlock( req.body );
+   }
+
+   serialize::ByteReader reader( req.body );
+   Block                 block = Block::decodeCompact( reader );
+   if ( reader.remaining() != 0 )
+   {
+      throw std::invalid_argument( "Trailing bytes after block" );
+   }
+
+   return block;
+}
+
+// ----------------------------------------------------------------------------
+std::string Node::chainJson( size_t from, size_t count ) const
+{
+   size_t size;
+   {
+      std::shared_lock<std::shared_mutex> lock( bc.chainMutex );
+      size = bc.chain.size();
+   }
+   const size_t last = from < size ? from + std::min( count, size - from ) : from;
+
+   std::string body = "[";
+   appendBlocksJson( from, last, false, true, body );
+   body += ']';
+   return body;
+}
+
+// ----------------------------------------------------------------------------
+bool Node::blockJson( size_t height, std::string& out ) const
+{
+   std::lock_guard<std::mutex>         lock( jsonCacheMutex );
+   std::shared_lock<std::shared_mutex> chainLock( bc.chainMutex );
+   if ( height >= bc.chain.size() )
+   {
+      return false;
+   }
+
+   out.clear();
+   appendBlockJson( height, true, out );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+void Node::appendBlocksJson( size_t first, size_t last, bool leadingComma,
+                             bool cache, std::string& out ) const
+{
+   // Taken per call, a stream holds neither lock between its chunks
+   std::lock_guard<std::mutex>         lock( jsonCacheMutex );
+   std::shared_lock<std::shared_mutex> chainLock( bc.chainMutex );
+
+   last = std::min( last, bc.chain.size() );
+   for ( size_t height = first; height < last; ++height )
+   {
+      if ( height > first || leadingComma )
+      {
+         out += ',';
+      }
+
+      appendBlockJson( height, cache, out );
+   }
+}
+
+// ----------------------------------------------------------------------------
+void Node::appendBlockJson( size_t height, bool cache, std::string& out ) const
+{
+   const Block& block  = bc.chain[ height ];
+   auto         cached = jsonCacheIndex.find( height );
+   if ( cached != jsonCacheIndex.end() )
+   {
+      if ( cached->second->hash == block.hash )
+      {
+         jsonCache.splice( jsonCache.begin(), jsonCache, cached->second );
+         out += cached->second->json;
+         return;
+      }
+
+      // Built for a block of a replaced chain
+      jsonCacheBytes -= cached->second->json.size();
+      jsonCache.erase( cached->second );
+      jsonCacheIndex.erase( cached );
+   }
+
+   json        j    = block;
+   std::string text = j.dump();
+   out += text;
+   if ( !cache || text.size() > MAX_JSON_CACHE_BYTES )
+   {
+      return;
+   }
+
+   jsonCacheBytes += text.size();
+   jsonCache.push_front( { height, block.hash, std::move( text ) } );
+   jsonCacheIndex[ height ] = jsonCache.begin();
+
+   while ( jsonCacheBytes > MAX_JSON_CACHE_BYTES )
+   {
+      const CachedJson& oldest = jsonCache.back();
+      jsonCacheBytes -= oldest.json.size();
+      jsonCacheIndex.erase( oldest.height );
+      jsonCache.pop_back();
+   }
+}
+
+// ----------------------------------------------------------------------------
+bool Node::parseRange( const httplib::Request& req, size_t maxCount,
+                       size_t& from, size_t& count )
+{
+   try
+   {
+      from  = req.has_param( "from" )
+                  ? std::stoul( req.get_param_value( "from" ) )
+                  : 0;
+      count = req.has_param( "count" )
+                  ? std::stoul( req.get_param_value( "count" ) )
+                  : maxCount;
+   }
+   catch ( const std::exception& e )
+   {
+      return false;
+   }
+
+   count = std::min( count, maxCount );
+   return true;
 }
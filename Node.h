@@ -1,12 +1,20 @@
 #pragma once
 
+#include <chrono>
 #include <json/json.hpp>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "Block.h"
 #include "Blockchain.h"
+#include "Broadcaster.h"
+#include "PeerPool.h"
+#include "SeenCache.h"
 
 // Vendor
 #include "vendor/Server.h"
@@ -16,7 +24,10 @@ class Node
  public:
    Node( Blockchain& bc_, std::string& host, int32_t port,
          const std::vector<std::string>& peers_ )
-       : bc{ bc_ }, peers{ std::move( peers_ ) }
+       : bc{ bc_ },
+         peers{ std::move( peers_ ) },
+         pool{ peers_ },
+         broadcaster{ pool, peers_ }
    {
       // I want to keep blockchain to not keep track of the peers and
       // communication stuff currentyl via callbacks
@@ -32,13 +43,27 @@ class Node
       svr.Post( "/tx",
                 [ & ]( const auto& req, auto& res )
                 {
+                   if ( isSeen( req ) || isRejected( req.body ) )
+                   {
+                      res.set_content( "Transaction Duplicate", "text/plain" );
+                      return;
+                   }
+
                    try
                    {
-                      auto        txJson = json::parse( req.body );
-                      Transaction tx     = txJson;
+                      Transaction tx = parseTransaction( req );
 
-                      std::cout << "Received transaction: " << txJson.dump( 4 )
-                                << std::endl;
+                      // Only accepted transactions become known, a rejected
+                      // one may be valid once its parent arrived
+                      if ( isSeen( req, tx.txid ) )
+                      {
+                         res.set_content( "Transaction Duplicate",
+                                          "text/plain" );
+                         return;
+                      }
+
+                      std::cout << "Received transaction: "
+                                << tx.toJson().dump( 4 ) << std::endl;
 
                       // Mempool holds pending transactions
                       if ( bc.addTransaction( tx ) )
@@ -51,6 +76,7 @@ class Node
                       else
                       {
                          std::cout << "Transaction rejected\n";
+                         markRejected( tx.txid, req.body );
                          res.set_content( "Transaction Duplicate",
                                           "text/plain" );
                       }
@@ -59,8 +85,10 @@ class Node
                    {
                       std::cerr << "Error processing transaction: " << e.what()
                                 << std::endl;
+                      markRejected( req.get_header_value( "X-Inventory-Id" ),
+                                    req.body );
                       res.status = 400;
-                      res.set_content( "INVALID JSON", "text/plain" );
+                      res.set_content( "INVALID TRANSACTION", "text/plain" );
                    }
                 } );
 
@@ -68,10 +96,43 @@ class Node
       svr.Post( "/block",
                 [ this ]( const httplib::Request& req, httplib::Response& res )
                 {
+                   if ( isSeen( req ) )
+                   {
+                      res.set_content( "Block Duplicate", "text/plain" );
+                      return;
+                   }
+
+                   if ( isRejected( req.body ) )
+                   {
+                      res.status = 400;
+                      res.set_content( "Invalid block", "text/plain" );
+                      return;
+                   }
+
                    try
                    {
-                      json  blockJson = json::parse( req.body );
-                      Block block     = blockJson;
+                      Block block = parseBlock( req );
+
+                      // A body whose header does not hash to the claimed id
+                      // says nothing about the real block with that id
+                      if ( !crypto::hexEquals( block.hash,
+                                               block.calculateDigest() ) )
+                      {
+                         markRejected( req.get_header_value( "X-Inventory-Id" ),
+                                       req.body );
+                         res.status = 400;
+                         res.set_content( "Invalid block hash", "text/plain" );
+                         return;
+                      }
+
+                      if ( isSeen( req, block.hash ) )
+                      {
+                         res.set_content( "Block Duplicate", "text/plain" );
+                         return;
+                      }
+
+                      // Known only once accepted, a block arriving out of
+                      // order may be valid later
                       if ( bc.addBlock( block ) )
                       {
                          std::cout << "Block received via Node\n";
@@ -80,6 +141,7 @@ class Node
                       }
                       else
                       {
+                         markRejected( block.hash, req.body );
                          res.status = 400;
                          res.set_content( "Invalid block", "text/plain" );
                       }
@@ -87,23 +149,220 @@ class Node
                    catch ( const std::exception& e )
                    {
                       std::cout << "ERROR: " << e.what() << std::endl;
+                      markRejected( req.get_header_value( "X-Inventory-Id" ),
+                                    req.body );
+                      res.status = 400;
+                      res.set_content( "Invalid block encoding", "text/plain" );
+                   }
+                } );
+
+      // Inventory announced by a peer, {"tx": [txid...], "block": [hash...]}.
+      // Answers with the ids this node wants, the peer then posts those in
+      // full to /tx and /block.
+      svr.Post( "/inv",
+                [ this ]( const httplib::Request& req, httplib::Response& res )
+                {
+                   try
+                   {
+                      res.set_content(
+                          wantedInventory( json::parse( req.body ) ).dump(),
+                          "application/json" );
+                   }
+                   catch ( const std::exception& e )
+                   {
                       res.status = 400;
                       res.set_content( "Invalid JSON", "text/plain" );
                    }
                 } );
 
-      svr.Get( "/chain",
+      svr.Get( "/inv/stats",
                [ this ]( const httplib::Request&, httplib::Response& res )
                {
-                  json j = bc.toJson();
-                  res.set_content( j.dump( 4 ), "application/json" );
+                  json j;
+                  j[ "seen" ]   = seen.size();
+                  j[ "hits" ]   = seen.hits();
+                  j[ "misses" ] = seen.misses();
+                  res.set_content( j.dump(), "application/json" );
+               } );
+
+      // A slice of the chain, /chain?from=H&count=N. Without count the rest
+      // of the chain from H on is streamed in chunks, the response never has
+      // to fit into memory as a whole.
+      svr.Get( "/chain",
+               [ this ]( const httplib::Request& req, httplib::Response& res )
+               {
+                  size_t from, count;
+                  if ( !parseRange( req, MAX_CHAIN_BLOCKS_PER_REQUEST, from,
+                                    count ) )
+                  {
+                     res.status = 400;
+                     res.set_content( "Invalid range", "text/plain" );
+                     return;
+                  }
+
+                  if ( req.has_param( "count" ) )
+                  {
+                     res.set_content( chainJson( from, count ),
+                                      "application/json" );
+                     return;
+                  }
+
+                  // Blocks added while streaming are not part of the answer.
+                  // Every chunk reads the chain under its lock again.
+                  size_t end;
+                  {
+                     std::shared_lock<std::shared_mutex> lock( bc.chainMutex );
+                     end = bc.chain.size();
+                  }
+                  res.set_chunked_content_provider(
+                      "application/json",
+                      [ this, from, next = from, end ](
+                          size_t, httplib::DataSink& sink ) mutable
+                      {
+                         std::string chunk = next == from ? "[" : "";
+                         if ( next < end )
+                         {
+                            const size_t last =
+                                std::min( end, next + BLOCKS_PER_CHUNK );
+                            appendBlocksJson( next, last, next != from, false,
+                                              chunk );
+                            next = last;
+                         }
+
+                         if ( next >= end )
+                         {
+                            chunk += ']';
+                         }
+
+                         if ( !sink.write( chunk.data(), chunk.size() ) )
+                         {
+                            return false;
+                         }
+
+                         if ( next >= end )
+                         {
+                            sink.done();
+                         }
+
+                         return true;
+                      } );
+               } );
+
+      svr.Get( "/block/:height",
+               [ this ]( const httplib::Request& req, httplib::Response& res )
+               {
+                  size_t height;
+                  try
+                  {
+                     height = std::stoul( req.path_params.at( "height" ) );
+                  }
+                  catch ( const std::exception& e )
+                  {
+                     res.status = 400;
+                     res.set_content( "Invalid height", "text/plain" );
+                     return;
+                  }
+
+                  std::string body;
+                  if ( !blockJson( height, body ) )
+                  {
+                     res.status = 404;
+                     res.set_content( "Block not found", "text/plain" );
+                     return;
+                  }
+
+                  res.set_content( body, "application/json" );
+               } );
+
+      // The hash is looked up in the block store's index
+      svr.Get( "/block/hash/:hash",
+               [ this ]( const httplib::Request& req, httplib::Response& res )
+               {
+                  int64_t height =
+                      bc.getBlockHeight( req.path_params.at( "hash" ) );
+
+                  std::string body;
+                  if ( height < 0 || !blockJson( height, body ) )
+                  {
+                     res.status = 404;
+                     res.set_content( "Block not found", "text/plain" );
+                     return;
+                  }
+
+                  res.set_content( body, "application/json" );
+               } );
+
+      // Headers first sync, the raw fixed size headers of a range of heights
+      // back to back. They are enough to check linkage and PoW.
+      svr.Get( "/headers",
+               [ this ]( const httplib::Request& req, httplib::Response& res )
+               {
+                  size_t from, count;
+                  if ( !parseRange( req, MAX_HEADERS_PER_REQUEST, from, count ) )
+                  {
+                     res.status = 400;
+                     res.set_content( "Invalid range", "text/plain" );
+                     return;
+                  }
+
+                  std::string body;
+                  body.reserve( count * Block::HEADER_SIZE );
+                  std::shared_lock<std::shared_mutex> lock( bc.chainMutex );
+                  for ( size_t height = from;
+                        height < from + count && height < bc.chain.size();
+                        ++height )
+                  {
+                     auto header = bc.chain[ height ].header();
+                     body.append( reinterpret_cast<const char*>( header.data() ),
+                                  header.size() );
+                  }
+
+                  res.set_content( body, "application/octet-stream" );
+               } );
+
+      // Block bodies of a range of heights. Nodes ask for the compact
+      // encoding via Accept, each block prefixed with its length so they can
+      // decode them as they arrive. Everyone else gets a json array.
+      svr.Get( "/blocks",
+               [ this ]( const httplib::Request& req, httplib::Response& res )
+               {
+                  size_t from, count;
+                  if ( !parseRange( req, MAX_BLOCKS_PER_REQUEST, from, count ) )
+                  {
+                     res.status = 400;
+                     res.set_content( "Invalid range", "text/plain" );
+                     return;
+                  }
+
+                  if ( req.get_header_value( "Accept" ) !=
+                       serialize::COMPACT_CONTENT_TYPE )
+                  {
+                     res.set_content( chainJson( from, count ),
+                                      "application/json" );
+                     return;
+                  }
+
+                  serialize::ByteWriter                writer;
+                  std::shared_lock<std::shared_mutex> lock( bc.chainMutex );
+                  for ( size_t height = from;
+                        height < from + count && height < bc.chain.size();
+                        ++height )
+                  {
+                     serialize::ByteWriter block;
+                     bc.chain[ height ].encodeCompact( block );
+                     writer.putString( block.data() );
+                  }
+
+                  res.set_content( writer.release(),
+                                   serialize::COMPACT_CONTENT_TYPE );
                } );
 
       // Needed to check if chain sync is needed
       svr.Get( "/chain/height",
                [ & ]( const httplib::Request&, httplib::Response& res )
                {
-                  nlohmann::json j;
+                  nlohmann::json                      j;
+                  std::shared_lock<std::shared_mutex> lock( bc.chainMutex );
                   j[ "height" ] =
                       bc.chain.size() -
                       1;   // Latest block index, because index starts at 0 and
@@ -132,17 +391,11 @@ class Node
                   auto userAddress = req.path_params.at( "address" );
 
                   nlohmann::json j = nlohmann::json::array();
-                  for ( const auto& u : bc.utxoSet )
+                  for ( const auto& u : bc.getUTXOsForAddress( userAddress ) )
                   {
-                     std::cout << "-------- " << u.txid << " " << u.outputIndex
-                               << " " << u.amount << " " << u.address
-                               << std::endl;
-                     if ( u.address == userAddress )
-                     {
-                        nlohmann::json uj;
-                        utxo::to_json( uj, u );
-                        j.push_back( uj );
-                     }
+                     nlohmann::json uj;
+                     utxo::to_json( uj, u );
+                     j.push_back( uj );
                   }
 
                   res.set_content( j.dump( 4 ), "application/json" );
@@ -150,7 +403,7 @@ class Node
 
    }
 
-   // Used via callback
+   // Used via callback, both only queue the message and return right away
    void               broadcastBlock( const Block& block ) const;
    void               broadcastTransaction( const Transaction& tx ) const;
    std::vector<Block> syncChain() const;
@@ -163,7 +416,116 @@ class Node
    std::pair<int32_t, std::string> getLongestChainHeight() const;
 
    httplib::Server          svr;
+
+   // Upper bounds for one /headers, /blocks or paginated /chain request
+   static constexpr size_t MAX_HEADERS_PER_REQUEST      = 2000;
+   static constexpr size_t MAX_BLOCKS_PER_REQUEST       = 100;
+   static constexpr size_t MAX_CHAIN_BLOCKS_PER_REQUEST = 500;
+   // Blocks per chunk of a streamed /chain response
+   static constexpr size_t BLOCKS_PER_CHUNK = 100;
+   // A longer length prefix in a /blocks response is treated as garbage
+   static constexpr uint32_t MAX_BLOCK_SIZE = 16 * 1024 * 1024;
+
  private:
+   // Height of every reachable peer, -1 for peers which did not answer
+   std::vector<std::pair<std::string, int32_t>> getPeerHeights() const;
+
+   // Downloads and checks the headers of peer up to height, returns the
+   // digests of the valid prefix
+   std::vector<crypto::Digest> fetchHeaders( const std::string& peer,
+                                             int32_t            height ) const;
+   // Fetches the bodies of [from, from + count) and checks each one against
+   // its header digest as soon as it is received
+   bool fetchBlocks( const std::string& peer, size_t from, size_t count,
+                     const std::vector<crypto::Digest>& hashes,
+                     std::vector<Block>&                blocks ) const;
+
+   // Compact json of the blocks in [from, from + count) as json array
+   std::string chainJson( size_t from, size_t count ) const;
+   // Returns false if there is no block at this height
+   bool blockJson( size_t height, std::string& out ) const;
+   // Appends the blocks in [first, last) comma separated. Streaming the whole
+   // chain passes cache = false, it would only push everything else out.
+   void appendBlocksJson( size_t first, size_t last, bool leadingComma,
+                          bool cache, std::string& out ) const;
+   // Expects jsonCacheMutex and the chain lock to be held
+   void appendBlockJson( size_t height, bool cache, std::string& out ) const;
+
+   // Returns false if the txid or block hash was already known, marks it known
+   // otherwise. Only for items that were accepted or created here.
+   bool markKnown( const std::string& id ) const;
+   // Bodies that failed to parse or validate are remembered by their sha256
+   // for REJECT_TIMEOUT, not by the id they claim. A garbage body can not
+   // block the real item, and an item invalid for now (parent missing, block
+   // out of order) is checked again later. The id may be fetched from
+   // another peer right away.
+   void markRejected( const std::string& id, const std::string& body ) const;
+   bool isRejected( const std::string& body ) const;
+   // Checks the X-Inventory-Id header peers send along with /tx and /block,
+   // a known id is rejected before its body gets parsed. Requests without
+   // the header, like the ones of the client, are checked after parsing.
+   bool isSeen( const httplib::Request& req ) const;
+   // The check after parsing. A request with the header was counted by the
+   // one above already, its id is only peeked at so it counts once.
+   bool isSeen( const httplib::Request& req, const std::string& id ) const;
+   // The part of an /inv announcement neither known nor requested from another
+   // peer yet. The returned ids count as requested until they arrive or
+   // REQUEST_TIMEOUT passed.
+   json wantedInventory( const json& inventory ) const;
+
+   // Bodies of /tx and /block are json, or compact encoded if the Content-Type
+   // says so. Both decode straight from the request buffer without a json DOM
+   // and throw on malformed input.
+   static Transaction parseTransaction( const httplib::Request& req );
+   static Block       parseBlock( const httplib::Request& req );
+
+   // Reads from and count query parameters, count is clamped to maxCount
+   static bool parseRange( const httplib::Request& req, size_t maxCount,
+                           size_t& from, size_t& count );
+
+
    Blockchain&              bc;
    std::vector<std::string> peers;
+
+   // Keep-alive connections to the peers, shared by all outgoing requests
+   mutable PeerPool pool;
+   // Queues block and transaction broadcasts, sending happens on its workers
+   mutable Broadcaster broadcaster;
+
+   // Blocks never change once they are in the chain, so their json is only
+   // built once. The most recently used ones are kept up to
+   // MAX_JSON_CACHE_BYTES. Every entry keeps the hash it was built for, a
+   // replaced chain just misses the cache.
+   struct CachedJson
+   {
+      size_t      height;
+      std::string hash;
+      std::string json;
+   };
+
+   static constexpr size_t MAX_JSON_CACHE_BYTES = 16 * 1024 * 1024;
+
+   mutable std::mutex            jsonCacheMutex;
+   mutable std::list<CachedJson> jsonCache;   // Most recently used first
+   mutable std::unordered_map<size_t, std::list<CachedJson>::iterator>
+                  jsonCacheIndex;
+   mutable size_t jsonCacheBytes = 0;
+
+   // Inventory gossip state. Known ids are the txids and block hashes this
+   // node received or announced, the least recently seen are dropped first.
+   // Requested ones were asked from a peer and are expected shortly.
+   static constexpr size_t MAX_KNOWN_INVENTORY = 50000;
+   static constexpr auto   REQUEST_TIMEOUT     = std::chrono::seconds( 10 );
+
+   using Clock = std::chrono::steady_clock;
+   mutable SeenCache seen{ MAX_KNOWN_INVENTORY };
+
+   static constexpr auto   REJECT_TIMEOUT      = std::chrono::seconds( 10 );
+   static constexpr size_t MAX_REJECTED        = 10000;
+
+   mutable std::mutex                                         inventoryMutex;
+   mutable std::unordered_map<std::string, Clock::time_point> requested;
+   mutable std::unordered_map<crypto::Digest, Clock::time_point,
+                              crypto::DigestHash>
+       rejected;
 };
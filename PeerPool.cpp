@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <iostream>
+
+#include "PeerPool.h"
+
+// ----------------------------------------------------------------------------
+PeerPool::PeerPool( const std::vector<std::string>& peers_ )
+{
+   for ( const auto& peer : peers_ )
+   {
+      peers[ peer ];
+   }
+}
+
+// ----------------------------------------------------------------------------
+httplib::Result PeerPool::get( const std::string& peer,
+                               const std::string& path )
+{
+   return request( peer,
+                   [ & ]( httplib::Client& cli ) { return cli.Get( path ); } );
+}
+
+// ----------------------------------------------------------------------------
+httplib::Result PeerPool::post( const std::string& peer,
+                                const std::string& path,
+                                const std::string& body,
+                                const std::string& contentType )
+{
+   return request( peer, [ & ]( httplib::Client& cli )
+                   { return cli.Post( path, body, contentType ); } );
+}
+
+// ----------------------------------------------------------------------------
+bool PeerPool::isHealthy( const std::string& peer ) const
+{
+   std::lock_guard<std::mutex> lock( mutex );
+
+   auto it = peers.find( peer );
+   return it != peers.end() && it->second.retryAt <= Clock::now();
+}
+
+// ----------------------------------------------------------------------------
+std::unique_ptr<httplib::Client> PeerPool::acquire( const std::string& peer )
+{
+   {
+      std::lock_guard<std::mutex> lock( mutex );
+
+      auto it = peers.find( peer );
+      if ( it == peers.end() || it->second.retryAt > Clock::now() )
+      {
+         return nullptr;
+      }
+
+      auto& idle = it->second.idle;
+      if ( !idle.empty() )
+      {
+         auto client = std::move( idle.back() );
+         idle.pop_back();
+         return client;
+      }
+   }
+
+   // Connecting happens on first use, outside of the lock
+   auto client = std::make_unique<httplib::Client>( peer );
+   client->set_keep_alive( true );
+   client->set_connection_timeout( CONNECT_TIMEOUT );
+   client->set_read_timeout( READ_TIMEOUT );
+   client->set_write_timeout( WRITE_TIMEOUT );
+   return client;
+}
+
+// ----------------------------------------------------------------------------
+void PeerPool::release( const std::string&               peer,
+                        std::unique_ptr<httplib::Client> client, bool ok )
+{
+   std::lock_guard<std::mutex> lock( mutex );
+
+   auto& state = peers.at( peer );
+   if ( !ok )
+   {
+      // The connection may be broken, it is dropped instead of reused. The
+      // backoff doubles with every failure in a row: 1s, 2s, 4s, ... 60s.
+      ++state.failures;
+      const uint32_t shift   = std::min( state.failures - 1, 6u );
+      const auto     backoff = std::min<Clock::duration>(
+          std::chrono::seconds( 1u << shift ), MAX_BACKOFF );
+      state.retryAt = Clock::now() + backoff;
+      state.idle.clear();
+
+      std::cout << "Peer " << peer << " failed " << state.failures
+                << " times in a row, backing off\n";
+      return;
+   }
+
+   state.failures = 0;
+   if ( state.idle.size() < MAX_IDLE_PER_PEER )
+   {
+      state.idle.push_back( std::move( client ) );
+   }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Vendor
+#include "vendor/Server.h"
+
+// ----------------------------------------------------------------------------
+// Keep-alive connections per peer, reused across requests instead of paying a
+// TCP connect for every message. A peer failing on the transport level is
+// backed off exponentially, requests to it fail right away until the backoff
+// expired instead of running into the connect timeout every time.
+class PeerPool
+{
+ public:
+   explicit PeerPool( const std::vector<std::string>& peers );
+
+   PeerPool( const PeerPool& )            = delete;
+   PeerPool& operator=( const PeerPool& ) = delete;
+
+   // Runs send( httplib::Client& ) on a pooled connection to peer and returns
+   // its httplib::Result. Several requests to one peer can run at the same
+   // time, each gets its own connection.
+   template <typename Send>
+   httplib::Result request( const std::string& peer, Send&& send )
+   {
+      auto client = acquire( peer );
+      if ( !client )
+      {
+         return httplib::Result( nullptr, httplib::Error::Connection );
+      }
+
+      httplib::Result res = send( *client );
+      release( peer, std::move( client ), static_cast<bool>( res ) );
+      return res;
+   }
+
+   httplib::Result get( const std::string& peer, const std::string& path );
+   httplib::Result post( const std::string& peer, const std::string& path,
+                         const std::string& body,
+                         const std::string& contentType );
+
+   // False while the peer is backed off
+   bool isHealthy( const std::string& peer ) const;
+
+ private:
+   using Clock = std::chrono::steady_clock;
+
+   struct Peer
+   {
+      std::vector<std::unique_ptr<httplib::Client>> idle;
+      uint32_t                                      failures = 0;
+      Clock::time_point                             retryAt;
+   };
+
+   // Returns nullptr for unknown or backed off peers
+   std::unique_ptr<httplib::Client> acquire( const std::string& peer );
+   void release( const std::string&               peer,
+                 std::unique_ptr<httplib::Client> client, bool ok );
+
+   static constexpr size_t MAX_IDLE_PER_PEER = 4;
+   static constexpr auto   CONNECT_TIMEOUT   = std::chrono::seconds( 1 );
+   static constexpr auto   READ_TIMEOUT      = std::chrono::seconds( 10 );
+   static constexpr auto   WRITE_TIMEOUT     = std::chrono::seconds( 5 );
+   static constexpr auto   MAX_BACKOFF       = std::chrono::seconds( 60 );
+
+   mutable std::mutex                    mutex;
+   std::unordered_map<std::string, Peer> peers;
+};
@@ -0,0 +1,61 @@
+#include "SeenCache.h"
+
+// ----------------------------------------------------------------------------
+SeenCache::SeenCache( size_t capacity_ ) : capacity{ capacity_ }
+{
+   entries.reserve( capacity );
+}
+
+// ----------------------------------------------------------------------------
+bool SeenCache::contains( const std::string& id )
+{
+   std::lock_guard<std::mutex> lock( mutex );
+
+   auto it = entries.find( id );
+   if ( it == entries.end() )
+   {
+      ++missCount;
+      return false;
+   }
+
+   ++hitCount;
+   order.splice( order.begin(), order, it->second );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+bool SeenCache::peek( const std::string& id ) const
+{
+   std::lock_guard<std::mutex> lock( mutex );
+   return entries.count( id ) > 0;
+}
+
+// ----------------------------------------------------------------------------
+bool SeenCache::insert( const std::string& id )
+{
+   std::lock_guard<std::mutex> lock( mutex );
+
+   auto it = entries.find( id );
+   if ( it != entries.end() )
+   {
+      order.splice( order.begin(), order, it->second );
+      return false;
+   }
+
+   if ( entries.size() >= capacity )
+   {
+      entries.erase( order.back() );
+      order.pop_back();
+   }
+
+   order.push_front( id );
+   entries.emplace( id, order.begin() );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+size_t SeenCache::size() const
+{
+   std::lock_guard<std::mutex> lock( mutex );
+   return entries.size();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// ----------------------------------------------------------------------------
+// Bounded set of recently seen txids and block hashes, the least recently
+// seen id is dropped once capacity is reached. Lookups count hits and misses.
+class SeenCache
+{
+ public:
+   explicit SeenCache( size_t capacity );
+
+   SeenCache( const SeenCache& )            = delete;
+   SeenCache& operator=( const SeenCache& ) = delete;
+
+   // Counts a hit and refreshes the id if it is cached, a miss otherwise
+   bool contains( const std::string& id );
+   // Neither counts nor refreshes, for lookups that are not a dedup check
+   bool peek( const std::string& id ) const;
+   // Returns false if the id was already cached
+   bool insert( const std::string& id );
+
+   size_t   size() const;
+   uint64_t hits() const { return hitCount; }
+   uint64_t misses() const { return missCount; }
+
+ private:
+   size_t capacity;
+
+   mutable std::mutex     mutex;
+   std::list<std::string> order;   // Most recently seen first
+   std::unordered_map<std::string, std::list<std::string>::iterator> entries;
+
+   std::atomic<uint64_t> hitCount{ 0 };
+   std::atomic<uint64_t> missCount{ 0 };
+};
@@ -0,0 +1,312 @@
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "Hash.h"
+#include "Serialize.h"
+
+namespace serialize
+{
+// ----------------------------------------------------------------------------
+int64_t toUnits( double amount )
+{
+   return std::llround( amount * UNITS_PER_COIN );
+}
+
+// ----------------------------------------------------------------------------
+double fromUnits( int64_t units )
+{
+   return static_cast<double>( units ) / UNITS_PER_COIN;
+}
+
+// ----------------------------------------------------------------------------
+bool isExactAmount( double amount )
+{
+   // Beyond 2^63 units llround has no result
+   return std::isfinite( amount ) && std::fabs( amount ) < 9.2e10 &&
+          fromUnits( toUnits( amount ) ) == amount;
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putU8( uint8_t value )
+{
+   buffer.push_back( static_cast<char>( value ) );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putU32( uint32_t value )
+{
+   for ( int shift = 24; shift >= 0; shift -= 8 )
+   {
+      putU8( static_cast<uint8_t>( value >> shift ) );
+   }
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putU64( uint64_t value )
+{
+   for ( int shift = 56; shift >= 0; shift -= 8 )
+   {
+      putU8( static_cast<uint8_t>( value >> shift ) );
+   }
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putI32( int32_t value )
+{
+   putU32( static_cast<uint32_t>( value ) );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putI64( int64_t value )
+{
+   putU64( static_cast<uint64_t>( value ) );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putBytes( const void* data, size_t length )
+{
+   buffer.append( reinterpret_cast<const char*>( data ), length );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putString( const std::string& value )
+{
+   putU32( static_cast<uint32_t>( value.size() ) );
+   putBytes( value.data(), value.size() );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putDouble( double value )
+{
+   uint64_t bits;
+   std::memcpy( &bits, &value, sizeof( bits ) );
+   putU64( bits );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putVarint( uint64_t value )
+{
+   while ( value >= 0x80 )
+   {
+      putU8( static_cast<uint8_t>( value | 0x80 ) );
+      value >>= 7;
+   }
+
+   putU8( static_cast<uint8_t>( value ) );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putSignedVarint( int64_t value )
+{
+   putVarint( ( static_cast<uint64_t>( value ) << 1 ) ^
+              static_cast<uint64_t>( value >> 63 ) );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putCompactString( const std::string& value )
+{
+   putVarint( value.size() );
+   putBytes( value.data(), value.size() );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putHashString( const std::string& value )
+{
+   // 0 tags a raw digest, otherwise the string's length + 1 follows. Only
+   // lowercase hex round trips through a digest unchanged.
+   crypto::Digest digest;
+   if ( crypto::fromHex( value, digest ) && crypto::toHex( digest ) == value )
+   {
+      putVarint( 0 );
+      putBytes( digest.data(), digest.size() );
+      return;
+   }
+
+   putVarint( value.size() + 1 );
+   putBytes( value.data(), value.size() );
+}
+
+// ----------------------------------------------------------------------------
+void ByteWriter::putAmount( double value )
+{
+   // The low bit tags the encoding, amounts are almost always exact units.
+   // Huge or non finite values would overflow the shifted units.
+   const bool    inRange = std::fabs( value ) < 1e9;
+   const int64_t units   = inRange ? toUnits( value ) : 0;
+   if ( inRange && fromUnits( units ) == value )
+   {
+      putSignedVarint( units * 2 );
+      return;
+   }
+
+   putSignedVarint( 1 );
+   putDouble( value );
+}
+
+// ----------------------------------------------------------------------------
+const std::string& ByteWriter::data() const
+{
+   return buffer;
+}
+
+// ----------------------------------------------------------------------------
+std::string ByteWriter::release()
+{
+   return std::move( buffer );
+}
+
+// ----------------------------------------------------------------------------
+ByteReader::ByteReader( std::string_view buffer_ ) : buffer{ buffer_ } {}
+
+// ----------------------------------------------------------------------------
+std::string_view ByteReader::take( size_t length )
+{
+   if ( length > remaining() )
+   {
+      throw std::out_of_range( "ByteReader: read past end of buffer" );
+   }
+
+   auto bytes = buffer.substr( offset, length );
+   offset += length;
+   return bytes;
+}
+
+// ----------------------------------------------------------------------------
+uint8_t ByteReader::getU8()
+{
+   return static_cast<uint8_t>( take( 1 )[ 0 ] );
+}
+
+// ----------------------------------------------------------------------------
+uint32_t ByteReader::getU32()
+{
+   auto     bytes = take( 4 );
+   uint32_t value = 0;
+   for ( const char c : bytes )
+   {
+      value = ( value << 8 ) | static_cast<uint8_t>( c );
+   }
+
+   return value;
+}
+
+// ----------------------------------------------------------------------------
+uint64_t ByteReader::getU64()
+{
+   auto     bytes = take( 8 );
+   uint64_t value = 0;
+   for ( const char c : bytes )
+   {
+      value = ( value << 8 ) | static_cast<uint8_t>( c );
+   }
+
+   return value;
+}
+
+// ----------------------------------------------------------------------------
+int32_t ByteReader::getI32()
+{
+   return static_cast<int32_t>( getU32() );
+}
+
+// ----------------------------------------------------------------------------
+int64_t ByteReader::getI64()
+{
+   return static_cast<int64_t>( getU64() );
+}
+
+// ----------------------------------------------------------------------------
+double ByteReader::getDouble()
+{
+   uint64_t bits = getU64();
+   double   value;
+   std::memcpy( &value, &bits, sizeof( value ) );
+   return value;
+}
+
+// ----------------------------------------------------------------------------
+void ByteReader::getBytes( void* out, size_t length )
+{
+   auto bytes = take( length );
+   std::memcpy( out, bytes.data(), length );
+}
+
+// ----------------------------------------------------------------------------
+std::string ByteReader::getString()
+{
+   uint32_t length = getU32();
+   return std::string( take( length ) );
+}
+
+// ----------------------------------------------------------------------------
+uint64_t ByteReader::getVarint()
+{
+   uint64_t value = 0;
+   for ( int shift = 0; shift < 64; shift += 7 )
+   {
+      const uint8_t byte = getU8();
+      value |= static_cast<uint64_t>( byte & 0x7f ) << shift;
+      if ( !( byte & 0x80 ) )
+      {
+         return value;
+      }
+   }
+
+   throw std::out_of_range( "ByteReader: varint too long" );
+}
+
+// ----------------------------------------------------------------------------
+int64_t ByteReader::getSignedVarint()
+{
+   const uint64_t value = getVarint();
+   return static_cast<int64_t>( value >> 1 ) ^
+          -static_cast<int64_t>( value & 1 );
+}
+
+// ----------------------------------------------------------------------------
+std::string ByteReader::getCompactString()
+{
+   const uint64_t length = getVarint();
+   return std::string( take( length ) );
+}
+
+// ----------------------------------------------------------------------------
+std::string ByteReader::getHashString()
+{
+   const uint64_t tag = getVarint();
+   if ( tag == 0 )
+   {
+      crypto::Digest digest;
+      getBytes( digest.data(), digest.size() );
+      return crypto::toHex( digest );
+   }
+
+   return std::string( take( tag - 1 ) );
+}
+
+// ----------------------------------------------------------------------------
+double ByteReader::getAmount()
+{
+   const int64_t value = getSignedVarint();
+   if ( value & 1 )
+   {
+      return getDouble();
+   }
+
+   return fromUnits( value / 2 );
+}
+
+// ----------------------------------------------------------------------------
+size_t ByteReader::remaining() const
+{
+   return buffer.size() - offset;
+}
+
+// ----------------------------------------------------------------------------
+size_t ByteReader::position() const
+{
+   return offset;
+}
+};   // namespace serialize
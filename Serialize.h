@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace serialize
+{
+// Amounts are doubles in memory, everything that gets hashed uses integer
+// units so rounding noise below 1e-8 can not change a hash
+constexpr int64_t UNITS_PER_COIN = 100000000;
+
+int64_t toUnits( double amount );
+double  fromUnits( int64_t units );
+// True if amount is a whole number of units, anything else would be hashed
+// as a different value than validation uses
+bool isExactAmount( double amount );
+
+// Blocks and transactions in their compact wire encoding, see encodeCompact.
+// The version is part of the media type, a new layout gets a new type.
+constexpr auto COMPACT_CONTENT_TYPE = "application/vnd.blockchain.compact.v1";
+
+// ----------------------------------------------------------------------------
+// Appends integers in big endian byte order and length prefixed strings
+class ByteWriter
+{
+ public:
+   void putU8( uint8_t value );
+   void putU32( uint32_t value );
+   void putU64( uint64_t value );
+   void putI32( int32_t value );
+   void putI64( int64_t value );
+   void putBytes( const void* data, size_t length );
+   void putString( const std::string& value );
+   void putDouble( double value );   // Exact bit pattern, not units
+
+   // Compact wire encoding. Varints are LEB128, signed ones zigzag encoded.
+   void putVarint( uint64_t value );
+   void putSignedVarint( int64_t value );
+   void putCompactString( const std::string& value );   // Varint length
+   // Lowercase hex digests as their 32 raw bytes, anything else as string
+   void putHashString( const std::string& value );
+   // Integer units if that is exact, the double's bit pattern otherwise
+   void putAmount( double value );
+
+   const std::string& data() const;
+   std::string        release();
+
+ private:
+   std::string buffer;
+};
+
+// ----------------------------------------------------------------------------
+// Counterpart of ByteWriter, throws std::out_of_range when reading past the
+// end of the buffer
+class ByteReader
+{
+ public:
+   explicit ByteReader( std::string_view buffer );
+
+   uint8_t     getU8();
+   uint32_t    getU32();
+   uint64_t    getU64();
+   int32_t     getI32();
+   int64_t     getI64();
+   double      getDouble();
+   void        getBytes( void* out, size_t length );
+   std::string getString();
+
+   uint64_t    getVarint();
+   int64_t     getSignedVarint();
+   std::string getCompactString();
+   std::string getHashString();
+   double      getAmount();
+
+   size_t remaining() const;
+   size_t position() const;
+
+ private:
+   std::string_view take( size_t length );
+
+   std::string_view buffer;
+   size_t           offset = 0;
+};
+
+};   // namespace serialize
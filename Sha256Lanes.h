@@ -0,0 +1,149 @@
+#pragma once
+
+// Generic multi lane sha256 compression. Only included by the kernel
+// translation units, each instantiates it with its own vector type and
+// compiler flags. Everything lives in an anonymous namespace so the linker
+// never merges code compiled for different instruction sets.
+
+#include <cstdint>
+
+#include "MiningKernel.h"
+
+namespace crypto
+{
+namespace
+{
+// ----------------------------------------------------------------------------
+// V provides the vector type T, LANES and the lane wise operations used below
+template <typename V>
+struct Sha256Lanes
+{
+   using T = typename V::T;
+
+   static T bigSigma0( T x )
+   {
+      return V::xor3( V::template ror<2>( x ), V::template ror<13>( x ),
+                      V::template ror<22>( x ) );
+   }
+
+   static T bigSigma1( T x )
+   {
+      return V::xor3( V::template ror<6>( x ), V::template ror<11>( x ),
+                      V::template ror<25>( x ) );
+   }
+
+   static T smallSigma0( T x )
+   {
+      return V::xor3( V::template ror<7>( x ), V::template ror<18>( x ),
+                      V::template shr<3>( x ) );
+   }
+
+   static T smallSigma1( T x )
+   {
+      return V::xor3( V::template ror<17>( x ), V::template ror<19>( x ),
+                      V::template shr<10>( x ) );
+   }
+
+   // -------------------------------------------------------------------------
+   // Compresses one block per lane into state, w holds the 16 message words
+   static void compress( T state[ 8 ], const T w0[ 16 ] )
+   {
+      T w[ 16 ];
+      for ( int i = 0; i < 16; ++i )
+      {
+         w[ i ] = w0[ i ];
+      }
+
+      T a = state[ 0 ], b = state[ 1 ], c = state[ 2 ], d = state[ 3 ];
+      T e = state[ 4 ], f = state[ 5 ], g = state[ 6 ], h = state[ 7 ];
+
+      for ( int i = 0; i < 64; ++i )
+      {
+         // Message schedule in a rolling window of 16 words
+         if ( i >= 16 )
+         {
+            w[ i & 15 ] = V::add( V::add( smallSigma1( w[ ( i - 2 ) & 15 ] ),
+                                          w[ ( i - 7 ) & 15 ] ),
+                                  V::add( smallSigma0( w[ ( i - 15 ) & 15 ] ),
+                                          w[ i & 15 ] ) );
+         }
+
+         T t1 = V::add( V::add( h, bigSigma1( e ) ),
+                        V::add( V::ch( e, f, g ),
+                                V::add( V::set1( SHA256_K[ i ] ),
+                                        w[ i & 15 ] ) ) );
+         T t2 = V::add( bigSigma0( a ), V::maj( a, b, c ) );
+
+         h = g;
+         g = f;
+         f = e;
+         e = V::add( d, t1 );
+         d = c;
+         c = b;
+         b = a;
+         a = V::add( t1, t2 );
+      }
+
+      state[ 0 ] = V::add( state[ 0 ], a );
+      state[ 1 ] = V::add( state[ 1 ], b );
+      state[ 2 ] = V::add( state[ 2 ], c );
+      state[ 3 ] = V::add( state[ 3 ], d );
+      state[ 4 ] = V::add( state[ 4 ], e );
+      state[ 5 ] = V::add( state[ 5 ], f );
+      state[ 6 ] = V::add( state[ 6 ], g );
+      state[ 7 ] = V::add( state[ 7 ], h );
+   }
+
+   // -------------------------------------------------------------------------
+   // Hashes the job for V::LANES nonces, one per lane
+   static void hash( const MiningJob& job, const uint64_t* nonces,
+                     Digest* digests )
+   {
+      alignas( 64 ) uint32_t high[ V::LANES ];
+      alignas( 64 ) uint32_t low[ V::LANES ];
+      for ( int lane = 0; lane < V::LANES; ++lane )
+      {
+         high[ lane ] = static_cast<uint32_t>( nonces[ lane ] >> 32 );
+         low[ lane ]  = static_cast<uint32_t>( nonces[ lane ] );
+      }
+
+      T w[ 16 ];
+      for ( int i = 0; i < 16; ++i )
+      {
+         w[ i ] = V::set1( job.block[ i ] );
+      }
+      w[ 4 ] = V::load( high );
+      w[ 5 ] = V::load( low );
+
+      T state[ 8 ];
+      for ( int i = 0; i < 8; ++i )
+      {
+         state[ i ] = V::set1( job.midstate[ i ] );
+      }
+
+      compress( state, w );
+
+      alignas( 64 ) uint32_t words[ 8 ][ V::LANES ];
+      for ( int i = 0; i < 8; ++i )
+      {
+         V::store( words[ i ], state[ i ] );
+      }
+
+      for ( int lane = 0; lane < V::LANES; ++lane )
+      {
+         for ( int i = 0; i < 8; ++i )
+         {
+            const uint32_t word = words[ i ][ lane ];
+            unsigned char* out  = &digests[ lane ][ 4 * i ];
+
+            out[ 0 ] = static_cast<unsigned char>( word >> 24 );
+            out[ 1 ] = static_cast<unsigned char>( word >> 16 );
+            out[ 2 ] = static_cast<unsigned char>( word >> 8 );
+            out[ 3 ] = static_cast<unsigned char>( word );
+         }
+      }
+   }
+};
+
+}   // namespace
+};   // namespace crypto
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <iostream>
 
 #include "Block.h"
+#include "Serialize.h"
 #include "Transaction.h"
 
 // ----------------------------------------------------------------------------
@@ -30,6 +32,220 @@ bool Transaction::operator==( const Transaction& other ) const
             amount == other.amount && timestamp == other.timestamp );
 }
 
+// ----------------------------------------------------------------------------
+std::string Transaction::serialize() const
+{
+   auto timestampSeconds = std::chrono::duration_cast<std::chrono::seconds>(
+                               timestamp.time_since_epoch() )
+                               .count();
+
+   serialize::ByteWriter writer;
+   writer.putString( txid );
+   writer.putString( sender );
+   writer.putString( receiver );
+   writer.putI64( serialize::toUnits( amount ) );
+   writer.putI64( serialize::toUnits( fee ) );
+   writer.putI64( timestampSeconds );
+   writer.putU8( isReward ? 1 : 0 );
+
+   writer.putU32( static_cast<uint32_t>( inputs.size() ) );
+   for ( const auto& input : inputs )
+   {
+      writer.putString( input.txid );
+      writer.putI32( input.outputIndex );
+      writer.putI64( serialize::toUnits( input.amount ) );
+      writer.putString( input.signature );
+   }
+
+   writer.putU32( static_cast<uint32_t>( outputs.size() ) );
+   for ( const auto& output : outputs )
+   {
+      writer.putString( output.address );
+      writer.putI64( serialize::toUnits( output.amount ) );
+   }
+
+   return writer.release();
+}
+
+// ----------------------------------------------------------------------------
+crypto::Digest Transaction::calculateHash() const
+{
+   auto bytes = serialize();
+   return crypto::sha256( bytes.data(), bytes.size() );
+}
+
+// ----------------------------------------------------------------------------
+bool Transaction::hasExactAmounts() const
+{
+   if ( !serialize::isExactAmount( amount ) ||
+        !serialize::isExactAmount( fee ) )
+   {
+      return false;
+   }
+
+   for ( const auto& input : inputs )
+   {
+      if ( !serialize::isExactAmount( input.amount ) )
+      {
+         return false;
+      }
+   }
+
+   for ( const auto& output : outputs )
+   {
+      if ( !serialize::isExactAmount( output.amount ) )
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+void Transaction::encode( serialize::ByteWriter& writer ) const
+{
+   auto timestampSeconds = std::chrono::duration_cast<std::chrono::seconds>(
+                               timestamp.time_since_epoch() )
+                               .count();
+
+   writer.putString( txid );
+   writer.putString( sender );
+   writer.putString( receiver );
+   writer.putDouble( amount );
+   writer.putDouble( fee );
+   writer.putI64( timestampSeconds );
+   writer.putU8( isReward ? 1 : 0 );
+
+   writer.putU32( static_cast<uint32_t>( inputs.size() ) );
+   for ( const auto& input : inputs )
+   {
+      writer.putString( input.txid );
+      writer.putI32( input.outputIndex );
+      writer.putDouble( input.amount );
+      writer.putString( input.signature );
+   }
+
+   writer.putU32( static_cast<uint32_t>( outputs.size() ) );
+   for ( const auto& output : outputs )
+   {
+      writer.putString( output.address );
+      writer.putDouble( output.amount );
+   }
+}
+
+// ----------------------------------------------------------------------------
+Transaction Transaction::decode( serialize::ByteReader& reader )
+{
+   Transaction tx;
+   tx.txid      = reader.getString();
+   tx.sender    = reader.getString();
+   tx.receiver  = reader.getString();
+   tx.amount    = reader.getDouble();
+   tx.fee       = reader.getDouble();
+   tx.timestamp = std::chrono::system_clock::time_point(
+       std::chrono::seconds( reader.getI64() ) );
+   tx.isReward = reader.getU8() != 0;
+
+   // Counts come from disk or the wire, only reserve what the buffer can hold
+   uint32_t inputCount = reader.getU32();
+   tx.inputs.reserve( std::min<size_t>( inputCount, reader.remaining() / 20 ) );
+   for ( uint32_t i = 0; i < inputCount; ++i )
+   {
+      Input input;
+      input.txid        = reader.getString();
+      input.outputIndex = reader.getI32();
+      input.amount      = reader.getDouble();
+      input.signature   = reader.getString();
+      tx.inputs.push_back( std::move( input ) );
+   }
+
+   uint32_t outputCount = reader.getU32();
+   tx.outputs.reserve(
+       std::min<size_t>( outputCount, reader.remaining() / 12 ) );
+   for ( uint32_t i = 0; i < outputCount; ++i )
+   {
+      Output output;
+      output.address = reader.getString();
+      output.amount  = reader.getDouble();
+      tx.outputs.push_back( std::move( output ) );
+   }
+
+   return tx;
+}
+
+// ----------------------------------------------------------------------------
+void Transaction::encodeCompact( serialize::ByteWriter& writer ) const
+{
+   auto timestampSeconds = std::chrono::duration_cast<std::chrono::seconds>(
+                               timestamp.time_since_epoch() )
+                               .count();
+
+   writer.putHashString( txid );
+   writer.putCompactString( sender );
+   writer.putCompactString( receiver );
+   writer.putAmount( amount );
+   writer.putAmount( fee );
+   writer.putSignedVarint( timestampSeconds );
+   writer.putU8( isReward ? 1 : 0 );
+
+   writer.putVarint( inputs.size() );
+   for ( const auto& input : inputs )
+   {
+      writer.putHashString( input.txid );
+      writer.putSignedVarint( input.outputIndex );
+      writer.putAmount( input.amount );
+      writer.putCompactString( input.signature );
+   }
+
+   writer.putVarint( outputs.size() );
+   for ( const auto& output : outputs )
+   {
+      writer.putCompactString( output.address );
+      writer.putAmount( output.amount );
+   }
+}
+
+// ----------------------------------------------------------------------------
+Transaction Transaction::decodeCompact( serialize::ByteReader& reader )
+{
+   Transaction tx;
+   tx.txid      = reader.getHashString();
+   tx.sender    = reader.getCompactString();
+   tx.receiver  = reader.getCompactString();
+   tx.amount    = reader.getAmount();
+   tx.fee       = reader.getAmount();
+   tx.timestamp = std::chrono::system_clock::time_point(
+       std::chrono::seconds( reader.getSignedVarint() ) );
+   tx.isReward = reader.getU8() != 0;
+
+   // An input takes at least 4 bytes, an output at least 2
+   uint64_t inputCount = reader.getVarint();
+   tx.inputs.reserve( std::min<size_t>( inputCount, reader.remaining() / 4 ) );
+   for ( uint64_t i = 0; i < inputCount; ++i )
+   {
+      Input input;
+      input.txid        = reader.getHashString();
+      input.outputIndex = static_cast<int>( reader.getSignedVarint() );
+      input.amount      = reader.getAmount();
+      input.signature   = reader.getCompactString();
+      tx.inputs.push_back( std::move( input ) );
+   }
+
+   uint64_t outputCount = reader.getVarint();
+   tx.outputs.reserve(
+       std::min<size_t>( outputCount, reader.remaining() / 2 ) );
+   for ( uint64_t i = 0; i < outputCount; ++i )
+   {
+      Output output;
+      output.address = reader.getCompactString();
+      output.amount  = reader.getAmount();
+      tx.outputs.push_back( std::move( output ) );
+   }
+
+   return tx;
+}
+
 // Transaction //
 // JSON serialization for Transaction //
 // ----------------------------------------------------------------------------
@@ -82,19 +298,24 @@ Transaction Transaction::createTransaction(
     double amount, double fee, const std::vector<utxo::UTXO>& availableUtxos,
     const std::string& privateKey )
 {
+   // Nodes only accept whole units, the change is computed in units too so
+   // no rounding noise ends up in an output
+   amount = serialize::fromUnits( serialize::toUnits( amount ) );
+   fee    = serialize::fromUnits( serialize::toUnits( fee ) );
+
    Transaction tx;
-   auto        needed = amount + fee;
+   auto needed = serialize::toUnits( amount ) + serialize::toUnits( fee );
 
    // Get UTXO for senderAddr
    // Node needs to remove unspent utxos later on
    std::vector<utxo::UTXO> unspentUTXO;
-   int32_t                 utxoAmountAccum{};
+   int64_t                 utxoAmountAccum{};
    for ( const auto& utxo : availableUtxos )
    {
       if ( utxo.address == senderAddr )
       {
          unspentUTXO.push_back( utxo );
-         utxoAmountAccum += utxo.amount;
+         utxoAmountAccum += serialize::toUnits( utxo.amount );
 
          tx.inputs.push_back(
              { utxo.txid, utxo.outputIndex, utxo.amount, privateKey } );
@@ -103,15 +324,16 @@ Transaction Transaction::createTransaction(
 
    if ( utxoAmountAccum < needed )
    {
-      std::cout << "Accumulated: " << utxoAmountAccum << std::endl;
-      std::cout << "Needed: " << needed << std::endl;
+      std::cout << "Accumulated: " << serialize::fromUnits( utxoAmountAccum )
+                << std::endl;
+      std::cout << "Needed: " << serialize::fromUnits( needed ) << std::endl;
       throw std::invalid_argument( "Unsuficient funds!!" );
    }
 
-   auto change = utxoAmountAccum - ( amount + fee );
+   auto change = utxoAmountAccum - needed;
    if ( change > 0 )
    {
-      tx.outputs.push_back( { senderAddr, change } );
+      tx.outputs.push_back( { senderAddr, serialize::fromUnits( change ) } );
    }
 
    tx.outputs.push_back( { receiverAddr, amount } );
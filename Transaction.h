@@ -5,8 +5,10 @@
 
 #include "UTXO.h"
 #include "json/json.hpp"
+#include "Hash.h"
 #include "Input.h"
 #include "Output.h"
+#include "Serialize.h"
 
 // for convenience
 using json = nlohmann::json;
@@ -22,6 +24,26 @@ class Transaction
    // ----------------------------------------------------------------------------
    bool operator==( const Transaction& other ) const;
 
+   // ----------------------------------------------------------------------------
+   // Canonical byte representation, amounts in integer units and timestamp in
+   // seconds like in json. Its hash is the merkle leaf of the transaction.
+   std::string    serialize() const;
+   crypto::Digest calculateHash() const;
+   // True if every amount is a whole number of units, only then the merkle
+   // leaf commits to exactly the values validation uses
+   bool hasExactAmounts() const;
+
+   // ----------------------------------------------------------------------------
+   // Lossless binary form used for storage, unlike serialize() amounts keep
+   // their exact double value. decode throws std::out_of_range on short input.
+   void               encode( serialize::ByteWriter& writer ) const;
+   static Transaction decode( serialize::ByteReader& reader );
+
+   // Wire form of encode: varints, raw digests and amounts in integer units
+   // where that is exact
+   void               encodeCompact( serialize::ByteWriter& writer ) const;
+   static Transaction decodeCompact( serialize::ByteReader& reader );
+
    // ----------------------------------------------------------------------------
    static Transaction
    createTransaction( const std::string& senderAddr,
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "UTXO.h"
 
 namespace utxo
@@ -19,4 +21,142 @@ void from_json( const json& j, UTXO& u )
    j.at( "amount" ).get_to( u.amount );
    j.at( "address" ).get_to( u.address );
 }
+
+// ----------------------------------------------------------------------------
+bool Outpoint::operator==( const Outpoint& other ) const
+{
+   return outputIndex == other.outputIndex && txid == other.txid;
+}
+
+// ----------------------------------------------------------------------------
+size_t OutpointHash::operator()( const Outpoint& outpoint ) const
+{
+   size_t seed = std::hash<std::string>{}( outpoint.txid );
+   return seed ^ ( std::hash<int>{}( outpoint.outputIndex ) +
+                   0x9e3779b97f4a7c15ull + ( seed << 6 ) + ( seed >> 2 ) );
+}
+
+// ----------------------------------------------------------------------------
+const UTXO* UTXOSet::find( const std::string& txid, int outputIndex ) const
+{
+   auto it = utxos.find( Outpoint{ txid, outputIndex } );
+   return it != utxos.end() ? &it->second : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+bool UTXOSet::contains( const std::string& txid, int outputIndex ) const
+{
+   return find( txid, outputIndex ) != nullptr;
+}
+
+// ----------------------------------------------------------------------------
+void UTXOSet::add( const UTXO& utxo )
+{
+   // Replacing an output must not leave it behind in the old owner's index
+   spend( utxo.txid, utxo.outputIndex );
+
+   Outpoint key{ utxo.txid, utxo.outputIndex };
+   utxos.emplace( key, utxo );
+   byAddress[ utxo.address ].insert( std::move( key ) );
+}
+
+// ----------------------------------------------------------------------------
+bool UTXOSet::spend( const std::string& txid, int outputIndex )
+{
+   auto it = utxos.find( Outpoint{ txid, outputIndex } );
+   if ( it == utxos.end() )
+   {
+      return false;
+   }
+
+   auto owner = byAddress.find( it->second.address );
+   if ( owner != byAddress.end() )
+   {
+      owner->second.erase( it->first );
+      if ( owner->second.empty() )
+      {
+         byAddress.erase( owner );
+      }
+   }
+
+   utxos.erase( it );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<UTXO> UTXOSet::forAddress( const std::string& address ) const
+{
+   std::vector<UTXO> result;
+
+   auto owner = byAddress.find( address );
+   if ( owner == byAddress.end() )
+   {
+      return result;
+   }
+
+   result.reserve( owner->second.size() );
+   for ( const auto& outpoint : owner->second )
+   {
+      result.push_back( utxos.at( outpoint ) );
+   }
+
+   return result;
+}
+
+// ----------------------------------------------------------------------------
+size_t UTXOSet::size() const
+{
+   return utxos.size();
+}
+
+// ----------------------------------------------------------------------------
+bool UTXOSet::empty() const
+{
+   return utxos.empty();
+}
+
+// ----------------------------------------------------------------------------
+void UTXOSet::clear()
+{
+   utxos.clear();
+   byAddress.clear();
+}
+// ----------------------------------------------------------------------------
+void UTXOSet::reserve( size_t count )
+{
+   utxos.reserve( count );
+}
+
+// ----------------------------------------------------------------------------
+void UTXOSet::writeTo( serialize::ByteWriter& writer ) const
+{
+   writer.putU64( utxos.size() );
+   for ( const auto& [ outpoint, utxo ] : utxos )
+   {
+      writer.putString( utxo.txid );
+      writer.putI32( utxo.outputIndex );
+      writer.putDouble( utxo.amount );
+      writer.putString( utxo.address );
+   }
+}
+
+// ----------------------------------------------------------------------------
+void UTXOSet::readFrom( serialize::ByteReader& reader )
+{
+   clear();
+
+   uint64_t count = reader.getU64();
+   // Every entry takes at least 20 bytes, a corrupt count must not make us
+   // reserve gigabytes
+   reserve( std::min<uint64_t>( count, reader.remaining() / 20 ) );
+   for ( uint64_t i = 0; i < count; ++i )
+   {
+      UTXO utxo;
+      utxo.txid        = reader.getString();
+      utxo.outputIndex = reader.getI32();
+      utxo.amount      = reader.getDouble();
+      utxo.address     = reader.getString();
+      add( utxo );
+   }
+}
 };   // namespace utxo
@@ -1,10 +1,16 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 // Vendor
 #include "json/json.hpp"
 
+// Project
+#include "Serialize.h"
+
 // for convenience
 using json = nlohmann::json;
 
@@ -25,5 +31,77 @@ void to_json( json& j, const UTXO& u );
 // ----------------------------------------------------------------------------
 void from_json( const json& j, UTXO& u );
 
-};   // namespace utxo
+// ----------------------------------------------------------------------------
+// Reference to a transaction output
+struct Outpoint
+{
+   std::string txid;
+   int         outputIndex;
+
+   bool operator==( const Outpoint& other ) const;
+};
+
+struct OutpointHash
+{
+   size_t operator()( const Outpoint& outpoint ) const;
+};
+
+// ----------------------------------------------------------------------------
+// Unspent outputs indexed by outpoint, plus a secondary index by owner address
+// so lookups, spends and balance queries do not scan the whole set
+class UTXOSet
+{
+   using Map = std::unordered_map<Outpoint, UTXO, OutpointHash>;
 
+ public:
+   // Iterates the UTXOs, order is unspecified
+   class const_iterator
+   {
+    public:
+      explicit const_iterator( Map::const_iterator it_ ) : it{ it_ } {}
+
+      const UTXO&     operator*() const { return it->second; }
+      const UTXO*     operator->() const { return &it->second; }
+      const_iterator& operator++()
+      {
+         ++it;
+         return *this;
+      }
+      bool operator!=( const const_iterator& other ) const
+      {
+         return it != other.it;
+      }
+
+    private:
+      Map::const_iterator it;
+   };
+
+   const_iterator begin() const { return const_iterator( utxos.begin() ); }
+   const_iterator end() const { return const_iterator( utxos.end() ); }
+
+   // Returns nullptr if the output does not exist or is spent
+   const UTXO* find( const std::string& txid, int outputIndex ) const;
+   bool        contains( const std::string& txid, int outputIndex ) const;
+
+   void add( const UTXO& utxo );
+   // Returns false if there was nothing to spend
+   bool spend( const std::string& txid, int outputIndex );
+
+   std::vector<UTXO> forAddress( const std::string& address ) const;
+
+   size_t size() const;
+   bool   empty() const;
+   void   clear();
+   void   reserve( size_t count );
+
+   // Binary form used for snapshots, amounts keep their exact double value
+   void writeTo( serialize::ByteWriter& writer ) const;
+   void readFrom( serialize::ByteReader& reader );
+
+ private:
+   Map utxos;
+   std::unordered_map<std::string, std::unordered_set<Outpoint, OutpointHash>>
+       byAddress;
+};
+
+};   // namespace utxo
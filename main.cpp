@@ -48,6 +48,18 @@ int main( int argc, char* argv[] )
    }
 
    Blockchain chain;
+   if ( argc > 2 )
+   {
+      // Optional number of mining threads, defaults to all hardware threads
+      chain.setMiningThreads( std::stoul( argv[ 2 ] ) );
+   }
+
+   if ( argc > 3 )
+   {
+      // Optional mempool budget in MiB
+      chain.setMempoolLimit( std::stoul( argv[ 3 ] ) * 1024 * 1024 );
+   }
+
    std::string nodeAddress{ "NodePort:" + port };
 
    Node node( chain, host, portInt, peers );